@@ -32,7 +32,7 @@ typedef struct {
 } arp_pkt_t;
 #pragma pack()
 
-typedef struct {
+typedef struct arp_entry_t {
     uint8_t paddr[IPV4_ADDR_SIZE];
     uint8_t hwaddr[ETHER_HWA_SIZE];
     enum {
@@ -42,13 +42,31 @@ typedef struct {
     } state;
     int tmo;
     int retry;
+    //lru order in cache_list, most recently used first
     node_t node;
+    //next entry in the same hash bucket
+    struct arp_entry_t * hash_next;
     list_t buf_list;
     netif_t * netif;
 } arp_entry_t;
 
+/**
+ * refreshes of the arp cache driven by inbound ip packets
+ */
+typedef struct {
+    //entry rewritten
+    int refresh_update;
+    //entry resolved to the same hwaddr within ARP_ENTRY_REFRESH_TMO, left as is
+    int refresh_skip;
+} arp_stats_t;
+
 net_err_t arp_init();
 
+/**
+ * get the arp counters
+ */
+void arp_get_stats(arp_stats_t * stats);
+
 /**
  * send a arp request
  */
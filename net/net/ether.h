@@ -46,4 +46,15 @@ const uint8_t * ether_broadcast_addr(void);
  */
 net_err_t ether_raw_out(netif_t * netif, uint16_t protocol, const uint8_t * dest, pktbuf_t * buf);
 
+/**
+ * build the ethernet header for frames from netif to dest
+ * @return header size
+ */
+int ether_hdr_build(netif_t * netif, uint16_t protocol, const uint8_t * dest, uint8_t * hdr);
+
+/**
+ * send buf with a header built by ether_hdr_build
+ */
+net_err_t ether_hdr_out(netif_t * netif, const uint8_t * hdr, pktbuf_t * buf);
+
 #endif //NET_ETHER_H
@@ -12,6 +12,8 @@
 
 typedef struct {
     netif_t * netif;
+    //queue index of the netif
+    int qid;
 } msg_netif_t;
 
 struct func_msg_t;
@@ -44,7 +46,7 @@ net_err_t test_func(func_msg_t * msg);
 
 net_err_t exmsg_init(void);
 net_err_t exmsg_start(void);
-net_err_t exmsg_netif_in(netif_t * netif);
+net_err_t exmsg_netif_in(netif_t * netif, int qid);
 
 net_err_t exmsg_func_exec(exmsg_func_t func, void * param);
 
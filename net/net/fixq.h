@@ -30,11 +30,31 @@ net_err_t fixq_init(fixq_t * q, void ** buf, int size, locker_type_t type);
  */
 net_err_t fixq_send(fixq_t * q, void * msg, int ms);
 
+/**
+ * send as many messages as fit without waiting, under one lock
+ * @return count of messages queued
+ */
+int fixq_send_burst(fixq_t * q, void ** msgs, int cnt);
+
 /**
  * recv message
  */
 void * fixq_recv(fixq_t * q, int ms);
 
+/**
+ * spin on the queue without sleeping
+ * @param us max spin time in us
+ */
+void * fixq_poll(fixq_t * q, int us);
+
+/**
+ * @return count of messages, read without the lock so it may be stale
+ */
+static inline int fixq_peek(fixq_t * q)
+{
+    return *(volatile int *)&q->cnt;
+}
+
 /**
  * destroy the queue
  */
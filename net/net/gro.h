@@ -0,0 +1,18 @@
+//
+// Created by wj on 2024/6/21.
+//
+
+#ifndef NET_GRO_H
+#define NET_GRO_H
+
+#include "netif.h"
+#include "pktbuf.h"
+
+/**
+ * merge in-order tcp segments of the same flow in a batch of received frames
+ * @param bufs frames in arrival order, frames merged into an earlier one are taken out
+ * @return count of frames left in bufs
+ */
+int gro_merge(netif_t * netif, pktbuf_t ** bufs, int cnt);
+
+#endif //NET_GRO_H
@@ -0,0 +1,19 @@
+//
+// Created by wj on 2024/6/20.
+//
+
+#ifndef NET_GSO_H
+#define NET_GSO_H
+
+#include "net_err.h"
+#include "netif.h"
+#include "pktbuf.h"
+
+/**
+ * cut a tcp super-segment or udp super-datagram into gso_size segments
+ * and put them into netif's out_q, the super-segment is freed on success
+ * @param buf link frame carrying ipv4 + tcp/udp, buf->gso_size set
+ */
+net_err_t gso_put_out(netif_t * netif, pktbuf_t * buf, int tmo);
+
+#endif //NET_GSO_H
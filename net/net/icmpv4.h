@@ -13,11 +13,15 @@ typedef enum {
     ICMPv4_ECHO_REQUEST = 8,
     ICMPv4_ECHO_REPLY = 0,
     ICMPv4_UNREACHABLE = 3,
+    ICMPv4_TIME_EXCEEDED = 11,
 } icmp_type_t;
 
 typedef enum {
     ICMPv4_ECHO = 0,
+    ICMPv4_UNREACHABLE_NET = 0,
     ICMPv4_UNREACHABLE_PORT = 3,
+    ICMPv4_UNREACHABLE_FRAG = 4,
+    ICMPv4_TTL_EXCEEDED = 0,
 } icmp_code_t;
 
 #pragma pack(1)
@@ -32,14 +36,57 @@ typedef struct {
     icmpv4_hdr_t hdr;
     union {
         uint32_t reverse;
-
+        //fragmentation needed
+        struct {
+            uint16_t unused;
+            uint16_t next_mtu;
+        };
     };
     uint8_t data[1];
 } icmp_pkt_t;
 #pragma pack()
 
+/**
+ * token bucket limiting generated icmp messages.
+ * tokens are kept in 1/1000 of a message, so each ms adds rate of them
+ */
+typedef struct {
+    //messages per second, 0: no limit
+    int rate;
+    //messages that may go back to back
+    int burst;
+    int tokens;
+    uint32_t last;
+} icmp_bucket_t;
+
+/**
+ * icmp messages this host held back
+ */
+typedef struct {
+    //over the rate of their type or of their dest
+    int rate_limited;
+} icmpv4_stats_t;
+
 net_err_t icmpv4_init();
 
+/**
+ * get the icmp counters
+ */
+void icmpv4_get_stats(icmpv4_stats_t * stats);
+
+/**
+ * limit the icmp messages of type this host sends, for echo reply, unreachable and time exceeded
+ * @param rate messages per second, 0: no limit
+ * @param burst messages sent back to back after a quiet time
+ */
+net_err_t icmpv4_set_rate(uint8_t type, int rate, int burst);
+
+/**
+ * limit the icmp messages sent to any one host, counted over all types.
+ * hosts hashing to the same slot share its bucket
+ */
+void icmpv4_set_src_rate(int rate, int burst);
+
 /**
  * input icmpv4 data packet
  */
@@ -50,4 +97,14 @@ net_err_t icmpv4_in(ipaddr_t * src_ip, ipaddr_t * netif_ip, pktbuf_t * buf);
  */
 net_err_t icmpv4_out_unreachable(ipaddr_t * dest_ip, ipaddr_t * src, uint8_t code, pktbuf_t * buf);
 
+/**
+ * output fragmentation needed, mtu is the size the next hop takes
+ */
+net_err_t icmpv4_out_frag_needed(ipaddr_t * dest_ip, ipaddr_t * src, int mtu, pktbuf_t * buf);
+
+/**
+ * output time exceeded for a packet whose ttl ran out in transit
+ */
+net_err_t icmpv4_out_time_exceeded(ipaddr_t * dest_ip, ipaddr_t * src, pktbuf_t * buf);
+
 #endif //NET_ICMPV4_H
@@ -14,6 +14,8 @@
 #define IPV4_ADDR_SIZE          4
 #define NET_VERSION_IPV4        4
 #define NET_IP_DEFAULT_TTL      64
+//more fragments flag and fragment offset in frag_all
+#define IP_FRAG_MASK            0x3FFF
 
 #pragma pack(1)
 //ipv4 struct
@@ -72,23 +74,82 @@ typedef struct
 
 #pragma pack()
 
-typedef struct {
+typedef struct ip_frag_t {
+    //src ip
     ipaddr_t ip;
+    ipaddr_t dest;
+    uint8_t protocol;
     uint16_t id;
     int tmo;
+    //fragments sorted by offset, never overlapping
     list_t buf_list;
+    //data bytes received, datagram size once the last fragment came (-1 before)
+    int recv_size, total_size;
+    //bytes of buf_list charged to IP_FRAG_MEM_MAX
+    int mem;
     node_t node;
+    struct ip_frag_t * hash_next;
 } ip_frag_t;
 
+//packet waiting for local delivery
 typedef struct {
+    netif_t * netif;
+    pktbuf_t * buf;
+} ip_local_t;
+
+typedef struct rentry_t {
     ipaddr_t net;
     ipaddr_t mask;
     int mask_1_cnt;
     ipaddr_t next_hop;
     netif_t * netif;
+    //1: delivers to this host, set by rt_add for loop and host-to-self routes
+    int local;
     node_t node;
+    //later entry with the same prefix, used once this one is removed
+    struct rentry_t * next;
 } rentry_t;
 
+/**
+ * node of the path compressed binary trie indexing the route table
+ */
+typedef struct rt_trie_t {
+    //prefix in host order, bits beyond len are 0
+    uint32_t key;
+    int len;
+    //route of exactly this prefix, null for pure branch nodes
+    rentry_t * entry;
+    struct rt_trie_t * child[2];
+} rt_trie_t;
+
+/**
+ * path mtu learned from icmp fragmentation needed, dropped after IP_PMTU_TMO to probe again
+ */
+typedef struct {
+    ipaddr_t dest;
+    int mtu;
+    int tmo;
+    node_t node;
+} ip_pmtu_t;
+
+/**
+ * output path cached by a socket, valid while gen matches the current route/arp generation
+ */
+typedef struct {
+    uint32_t gen;
+    ipaddr_t dest;
+    netif_t * netif;
+    ipaddr_t next_hop;
+    int local;
+    //path mtu, 0: no limit
+    int mtu;
+    //set DF, the owner sizes its packets by mtu
+    int df;
+    //prebuilt link header, 0: not resolved yet
+    int hdr_len;
+    uint8_t hdr[IP_DST_HDR_MAX];
+} ip_dst_t;
+
 /**
  * init ipv4
  */
@@ -104,6 +165,38 @@ net_err_t ipv4_in(netif_t * netif, pktbuf_t * buf);
  */
 net_err_t ipv4_out(uint8_t protocol, ipaddr_t * dest, ipaddr_t * src, pktbuf_t * buf);
 
+/**
+ * output ipv4 data packet through the socket's cached destination
+ */
+net_err_t ipv4_out_dst(uint8_t protocol, ipaddr_t * dest, ipaddr_t * src, pktbuf_t * buf, ip_dst_t * dst);
+
+/**
+ * look up dest again if dst is stale or caches another address
+ */
+net_err_t ipv4_dst_update(ip_dst_t * dst, ipaddr_t * dest);
+
+/**
+ * drop every cached destination, called when routes or arp entries change
+ */
+void ipv4_dst_invalidate(void);
+
+/**
+ * lower the path mtu to dest after a fragmentation needed error
+ * @param mtu next hop mtu reported by the router, 0 if it sent none
+ * @param sent_size total length of the datagram that was too big
+ */
+void ipv4_pmtu_update(ipaddr_t * dest, int mtu, int sent_size);
+
+/**
+ * @return 1 if packets to ip are delivered to this host
+ */
+int ipv4_is_local(ipaddr_t * ip);
+
+/**
+ * deliver packets queued by ipv4_out for local addresses
+ */
+void ipv4_local_poll(void);
+
 /**
  * get the size of ipv4 data packet header
  * @param pkt ipv4 data packet
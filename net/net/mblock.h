@@ -22,10 +22,23 @@ typedef struct mblock_t
     locker_t locker;
     //alloc memory-block sem
     sys_sem_t alloc_sem;
+    int blk_size;
+    //blocks owned by the pool, static and grown
+    int total;
+    //growth limit and step, 0: never grows
+    int max_cnt;
+    int slab_cnt;
+    //slabs taken from the heap
+    list_t slab_list;
 } mblock_t;
 
 net_err_t mblock_init(mblock_t * mblock, void * mem, int blk_size, int cnt, locker_type_t type);
 
+/**
+ * let a LOCKER_NONE pool grow from the heap, slab_cnt blocks at a time, up to max_cnt blocks in all
+ */
+void mblock_set_grow(mblock_t * mblock, int slab_cnt, int max_cnt);
+
 /**
  * alloc a memory-block
  * @param ms Timeout period, in milliseconds
@@ -17,10 +17,14 @@
 #define socklen_t   x_socklen_t
 #undef timeval
 #define timeval     x_timeval
+#undef mmsghdr
+#define mmsghdr     x_mmsghdr
 
 #define socket(family, type, protocol)                      x_socket(family, type, protocol)
 #define sendto(s, buf, len, flags, dest, dlen)              x_sendto(s, buf, len, flags, dest, dlen)
 #define recvfrom(s, buf, len, flags, src, slen)             x_recvfrom(s, buf, len, flags, src, slen)
+#define sendmmsg(s, msgs, cnt, flags)                       x_sendmmsg(s, msgs, cnt, flags)
+#define recvmmsg(s, msgs, cnt, flags)                       x_recvmmsg(s, msgs, cnt, flags)
 #define setsockopt(s, level, optname, optval, len)          x_setsockopt(s, level, optname, optval, len)
 #define close(s)                                            x_close(s)
 #define connect(s, addr, addr_len)                          x_connect(s, addr, addr_len)
@@ -29,7 +29,7 @@
 
 #define EXMSG_MSG_CNT           10
 #define PKTBUF_BLK_SIZE         127
-#define PKTBUF_BLK_CNT          100
+#define PKTBUF_BLK_CNT          512
 #define PKTBUF_BUF_CNT          100
 
 #define EXMSG_LOCKER            LOCKER_THREAD
@@ -39,33 +39,79 @@
 #define NETIF_INQ_SIZE          50
 #define NETIF_OUTQ_SIZE         50
 #define NETIF_DEV_CNT           10
-
-#define TIMER_NAME_SIZE         32
+#define NETIF_MTU_MAX           9000
+#define NETIF_QUEUE_MAX         4
+//busy poll: first spin in us, and the arrival gap in ms that still counts as busy
+#define NETIF_BUSY_POLL_MIN     8
+#define NETIF_BUSY_POLL_GAP     1
+#define NETIF_GRO_BATCH         16
+#define NETIF_GRO_FLOWS         4
+#define NETIF_GRO_MAX_SIZE      (16 * 1024)
+#define NETIF_RCV_BUF_SIZE      (1024 * 1024)
+#define NETIF_RCV_IMMEDIATE     1
+#define NETIF_RCV_TMO           10
+#define NETIF_RCV_BURST         32
+#define NETIF_FILTER_PORTS      32
+#define REPLAY_FRAME_MAX        (NETIF_MTU_MAX + 14)
+
+//timer wheel: slots of (1 << NET_TIMER_TICK_SHIFT) ms, size is a power of 2
+#define NET_TIMER_WHEEL_SIZE    1024
+#define NET_TIMER_TICK_SHIFT    3
 
 #define NET_ENDIAN_LITTLE       1
 
-#define ARP_TABLE_SIZE          50
+#define ARP_TABLE_SIZE          1024
+#define ARP_HASH_SIZE           256
 #define ARP_MAX_PKT_WAIT        5
 #define ARP_TIMER_TMO           1
 #define ARP_ENTRY_PENDING_TMO   3
 #define ARP_ENTRY_RETRY_CNT     5
 #define ARP_ENTRY_STABLE_TMO    (20*60)
-
-#define IP_FRAGS_MAX_NR         5
-#define IP_FRAG_MAX_BUF_NR      10
+#define ARP_ENTRY_REFRESH_TMO   10
+
+#define ICMP_RATE_ECHO          1000
+#define ICMP_RATE_ERROR         200
+#define ICMP_RATE_BURST         100
+#define ICMP_RATE_SRC           50
+#define ICMP_RATE_SRC_BURST     50
+#define ICMP_RATE_SRC_NR        64
+
+#define IP_FRAGS_MAX_NR         32
+#define IP_FRAG_MAX_BUF_NR      64
+#define IP_FRAG_HASH_SIZE       64
+#define IP_FRAG_MEM_MAX         (32 * 1024)
 #define IP_FRAG_SCAN_PERIOD     1
 #define IP_FRAG_TMO             10
-#define IP_RTTABLE_SIZE         20
+#define IP_RTTABLE_SIZE         4096
+#define IP_LOCAL_QUEUE_SIZE     64
+#define IP_DST_HDR_MAX          16
+#define IP_PMTU_TBL_SIZE        64
+#define IP_PMTU_SCAN_PERIOD     60
+#define IP_PMTU_TMO             (10 * 60)
+#define IP_PMTU_MIN             68
 
 #define RAW_MAX_NR              10
 #define RAW_MAX_RECV            50
 
-#define UDP_MAX_NR              10
+#define UDP_MAX_NR              512
+#define UDP_HASH_SIZE           256
 #define UDP_MAX_RECV            50
+#define UDP_GSO_MAX_SIZE        (16 * 1024)
+#define UDP_GSO_MAX_SEGS        64
 
-#define TCP_MAX_NR              10
+//control blocks: TCP_INIT_NR static, then up to TCP_MAX_NR from the heap TCP_SLAB_NR at a time
+#define TCP_MAX_NR              (128 * 1024)
+#define TCP_INIT_NR             10
+#define TCP_SLAB_NR             64
 #define TCP_SBUF_SIZE           4096
 #define TCP_RBUF_SIZE           4096
+//send/receive storage, held only while a buffer has data
+#define TCP_BUF_MAX_NR          (16 * 1024)
+#define TCP_BUF_INIT_NR         10
+#define TCP_BUF_SLAB_NR         16
+#define TCP_GSO_MAX_SIZE        (16 * 1024)
+#define TCP_HASH_SIZE           1024
+#define TCP_CONN_HASH_SIZE      (16 * 1024)
 
 #define TCP_KEEPALIVE_TIME      (20 * 60 * 60)
 #define TCP_KEEPALIVE_INTVL     5
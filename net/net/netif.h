@@ -29,13 +29,70 @@ typedef enum netif_type_t {
 
 struct netif_t;
 
+//local ports admitted by the driver's receive filter, besides arp, icmp and ip fragments
+typedef struct netif_filter_t {
+    //1: too many ports to list, admit everything for our mac
+    int all;
+    int tcp_cnt;
+    int udp_cnt;
+    uint16_t tcp_ports[NETIF_FILTER_PORTS];
+    uint16_t udp_ports[NETIF_FILTER_PORTS];
+} netif_filter_t;
+
+//receive settings, read by the driver when it is opened or through ops->set_rcv_cfg
+typedef struct netif_rcv_cfg_t
+{
+    //driver capture buffer size in bytes
+    int buf_size;
+    //1: deliver each frame as it arrives, 0: let the driver batch frames for throughput
+    int immediate;
+    //max frames handed over by one netif_put_in_burst
+    int burst;
+} netif_rcv_cfg_t;
+
 typedef struct netif_ops_t
 {
     net_err_t (*open)(struct netif_t * netif, void * data);
     void (*close)(struct netif_t * netif);
     net_err_t (*xmit)(struct netif_t * netif);
+    //optional: install a receive filter, also called on activation
+    net_err_t (*set_filter)(struct netif_t * netif, const netif_filter_t * filter);
+    //optional: apply new receive settings to the open device
+    net_err_t (*set_rcv_cfg)(struct netif_t * netif, const netif_rcv_cfg_t * cfg);
 } netif_ops_t;
 
+//rx/tx queue pair
+typedef struct netif_queue_t
+{
+    //input fixed msg queue
+    fixq_t in_q;
+    //input buf
+    void * in_q_buf[NETIF_INQ_SIZE];
+    //output fixed msg queue
+    fixq_t out_q;
+    //output buf
+    void * out_q_buf[NETIF_OUTQ_SIZE];
+} netif_queue_t;
+
+//busy poll state of one direction
+typedef struct netif_poll_t
+{
+    //current spin time in us, adapted to the recent arrival rate
+    int budget;
+    //time of last arrival
+    net_time_t last;
+} netif_poll_t;
+
+//ipv4 forwarding counters
+typedef struct {
+    //received here for another host / sent out here for another host
+    uint32_t in, out;
+    //dropped: no route, ttl run out, too big with DF, output failed
+    uint32_t no_route, ttl_exceeded, frag_needed, out_err;
+    //forwarded as fragments
+    uint32_t fragmented;
+} netif_fwd_stats_t;
+
 typedef struct {
     netif_type_t type;
     net_err_t (*open)(struct netif_t * netif);
@@ -72,6 +129,17 @@ typedef struct netif_t {
         NETIF_ACTIVE,
     } state;
 
+    //receive settings
+    netif_rcv_cfg_t rcv_cfg;
+    //longest spin before sleeping in us, 0: busy poll off
+    int busy_poll_max;
+    //xmit thread side busy poll, the worker side is shared by all netifs
+    netif_poll_t out_poll;
+
+    //1: route ipv4 packets for other hosts to the netif of their route
+    int forward;
+    netif_fwd_stats_t fwd_stats;
+
     //net operation
     netif_ops_t * ops;
     void * ops_data;
@@ -81,14 +149,10 @@ typedef struct netif_t {
 
     //node
     node_t node;
-    //input fixed msg queue
-    fixq_t in_q;
-    //input buf
-    void * in_q_buf[NETIF_INQ_SIZE];
-    //output fixed msg queue
-    fixq_t out_q;
-    //output buf
-    void * out_q_buf[NETIF_OUTQ_SIZE];
+    //count of queue pairs in use
+    int queue_cnt;
+    //queue pairs, steered by pktbuf flow_hash
+    netif_queue_t queues[NETIF_QUEUE_MAX];
 } netif_t;
 
 /**
@@ -113,6 +177,26 @@ net_err_t netif_set_addr(netif_t * netif, ipaddr_t * ip, ipaddr_t * mask, ipaddr
  */
 net_err_t netif_set_hwaddr(netif_t * netif, const char * hwaddr, int len);
 
+/**
+ * set netif's mtu, up to NETIF_MTU_MAX
+ */
+net_err_t netif_set_mtu(netif_t * netif, int mtu);
+
+/**
+ * enable or disable forwarding of packets received on netif
+ */
+void netif_set_forward(netif_t * netif, int enable);
+
+/**
+ * add a local port to filter, overflowing NETIF_FILTER_PORTS switches it to all
+ */
+void netif_filter_add(netif_filter_t * filter, uint8_t protocol, uint16_t port);
+
+/**
+ * install filter on every active netif whose driver supports it, skipped if unchanged
+ */
+void netif_set_filter(const netif_filter_t * filter);
+
 /**
  * set netif active state
  */
@@ -139,27 +223,106 @@ void netif_set_default(netif_t * netif);
 netif_t * netif_get_default();
 
 /**
- * write data packet to net interface's in_q
+ * set the count of rx/tx queue pairs, called by drivers in open
+ */
+net_err_t netif_set_queue_cnt(netif_t * netif, int cnt);
+
+/**
+ * @return queue index for the packet's flow
+ */
+static inline int netif_queue_select(netif_t * netif, pktbuf_t * buf)
+{
+    return (int)(buf->flow_hash % (uint32_t)netif->queue_cnt);
+}
+
+/**
+ * write data packet to net interface's in_q, the queue is chosen by flow hash
  * @param tmo timeout
  */
 net_err_t netif_put_in(netif_t * netif, pktbuf_t * buf, int tmo);
 
 /**
- * get data packet from net interface's in_q
+ * write data packet to in_q of given queue
+ */
+net_err_t netif_put_in_queue(netif_t * netif, int qid, pktbuf_t * buf, int tmo);
+
+/**
+ * write a burst of data packets to in_q of given queue, notify the work thread once
+ * @return count of packets queued, the caller still owns the rest
+ */
+int netif_put_in_burst(netif_t * netif, int qid, pktbuf_t ** bufs, int cnt);
+
+/**
+ * write a burst of received frames, each to the in_q picked by its flow,
+ * frames that do not fit are freed
+ * @return count of frames queued
+ */
+int netif_put_in_steer(netif_t * netif, pktbuf_t ** bufs, int cnt);
+
+/**
+ * hash the ipv4 addresses and tcp/udp ports of a received frame, so that a flow keeps to one queue
+ */
+uint32_t netif_rx_hash(netif_t * netif, pktbuf_t * buf);
+
+/**
+ * @return 1 if any out_q of netif holds packets, read without locking
+ */
+int netif_out_pending(netif_t * netif);
+
+/**
+ * change receive settings, an open driver applies them through ops->set_rcv_cfg,
+ * otherwise they take effect on the next open
+ */
+net_err_t netif_set_rcv_cfg(netif_t * netif, const netif_rcv_cfg_t * cfg);
+
+/**
+ * enable busy polling of the netif queues
+ * @param max_us longest spin before sleeping in us, 0 turns busy poll off
+ */
+net_err_t netif_set_busy_poll(netif_t * netif, int max_us);
+
+/**
+ * called by the work thread when packets of netif arrived
+ */
+void netif_poll_in_update(netif_t * netif);
+
+/**
+ * called by the work thread when a whole spin found nothing
+ */
+void netif_poll_in_idle(void);
+
+/**
+ * @return rx spin time of the work thread in us
+ */
+int netif_poll_budget(void);
+
+/**
+ * get data packet from net interface's first in_q
  */
 pktbuf_t * netif_get_in(netif_t * netif, int tmo);
 
 /**
- * write data packet to net interface's out_q
+ * get data packet from in_q of given queue
+ */
+pktbuf_t * netif_get_in_queue(netif_t * netif, int qid, int tmo);
+
+/**
+ * write data packet to net interface's out_q, the queue is chosen by flow hash
  * @param tmo timeout
  */
 net_err_t netif_put_out(netif_t * netif, pktbuf_t * buf, int tmo);
 
 /**
- * get data packet from net interface's out_q
+ * get data packet from net interface's first out_q
  */
 pktbuf_t * netif_get_out(netif_t * netif, int tmo);
 
+/**
+ * get data packet from out_q of given queue,
+ * spins first when busy poll is on and tmo is not negative
+ */
+pktbuf_t * netif_get_out_queue(netif_t * netif, int qid, int tmo);
+
 /**
  * send data packet to given ipaddr
  */
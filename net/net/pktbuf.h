@@ -38,6 +38,16 @@ typedef struct pktbuf_t
     pktblk_t * curr_blk;
     //current data access pktblk's offset
     uint8_t * blk_offset;
+    //checksums need no verification (local delivery)
+    int csum_valid;
+    //flow hash, used to pick netif queue
+    uint32_t flow_hash;
+    //gso: segment payload size, 0 if not a super-segment
+    int gso_size;
+    //gso: count of segments
+    int gso_segs;
+    //gro: rx frame merged from several wire frames, may exceed the mtu
+    int gro;
 } pktbuf_t;
 
 /**
@@ -51,6 +61,13 @@ pktbuf_t * pktbuf_alloc(int size);
 //free pktbuf_t
 void pktbuf_free(pktbuf_t * buf);
 
+/**
+ * alloc pktbufs for a burst of frames holding the allocator lock once
+ * @param sizes size of each pktbuf
+ * @return count of leading pktbufs allocated, the pools are not touched for the rest
+ */
+int pktbuf_alloc_burst(pktbuf_t ** bufs, const int * sizes, int cnt);
+
 /**
  * @param block given pktblk_t
  * @return given block's next pktblk_t
@@ -173,6 +190,15 @@ net_err_t pktbuf_resize(pktbuf_t * buf, int size);
  */
 net_err_t pktbuf_merge(pktbuf_t * dest, pktbuf_t * src);
 
+/**
+ * split the first size bytes of buf off into a new pktbuf_t.
+ * whole blocks are moved, only a block across the cut is partly copied
+ * @param buf source pktbuf_t, keeps the remaining bytes
+ * @param size byte size to split off
+ * @return the new pktbuf_t, or 0 if failed (buf is left untouched)
+ */
+pktbuf_t * pktbuf_split(pktbuf_t * buf, int size);
+
 /**
  * set pktbuf's header continuous
  * @param size Byte size to be merged
@@ -8,6 +8,7 @@
 #include "sock.h"
 #include "pktbuf.h"
 #include "list.h"
+#include "netif.h"
 
 typedef struct {
     sock_t base;
@@ -24,4 +25,9 @@ sock_t * raw_create(int family, int protocol);
  */
 net_err_t raw_in(pktbuf_t * pktbuf);
 
+/**
+ * open filter up to all traffic while a raw socket wants more than icmp
+ */
+void raw_filter_ports(netif_filter_t * filter);
+
 #endif //NET_RAW_H
@@ -11,6 +11,7 @@
 #include "list.h"
 #include "sys_plat.h"
 #include "exmsg.h"
+#include "ipv4.h"
 
 struct sock_t;
 struct x_sockaddr;
@@ -40,6 +41,9 @@ typedef struct {
             const struct x_sockaddr * src, x_socklen_t * src_len, ssize_t * result_len);
     //recv data from socket
     net_err_t (*recv) (struct sock_t * s, void * buf, size_t len, int flags, ssize_t * result_len);
+    //take the next received datagram without copying it
+    net_err_t (*recvbuf) (struct sock_t * s, pktbuf_t ** buf, int flags,
+            struct x_sockaddr * src, x_socklen_t * src_len);
     //set options
     net_err_t (*setopt) (struct sock_t * s, int level, int optname, const char * optval, int optlen);
     //destroy socket
@@ -66,11 +70,16 @@ typedef struct sock_t {
     int err;
     int rcv_tmo;
     int send_tmo;
+    //SO_REUSEPORT: share local ip:port with other reuseport sockets
+    int reuseport;
 
     sock_wait_t * rcv_wait;
     sock_wait_t * snd_wait;
     sock_wait_t * conn_wait;
 
+    //route and link header towards remote_ip
+    ip_dst_t dst;
+
     node_t node;
 } sock_t;
 
@@ -80,6 +89,8 @@ typedef struct {
         SOCKET_STATE_USED
     } state;
     sock_t * sock;
+    //links the free list while free
+    node_t node;
 } x_socket_t;
 
 typedef struct {
@@ -97,6 +108,21 @@ typedef struct {
     ssize_t comp_len;
 } sock_data_t;
 
+typedef struct {
+    pktbuf_t * buf;
+    int flags;
+    struct x_sockaddr * addr;
+    x_socklen_t * addr_len;
+} sock_view_t;
+
+typedef struct {
+    struct x_mmsghdr * msgs;
+    int cnt;
+    int flags;
+    //messages done
+    int comp_cnt;
+} sock_mmsg_t;
+
 typedef struct {
     int level;
     int optname;
@@ -132,6 +158,8 @@ typedef struct {
     union {
         sock_create_t create;
         sock_data_t data;
+        sock_mmsg_t mmsg;
+        sock_view_t view;
         sock_opt_t opt;
         sock_conn_t conn;
         sock_bind_t bind;
@@ -152,7 +180,11 @@ net_err_t sock_wait_init(sock_wait_t * wait);
 
 void sock_wait_destroy(sock_wait_t * wait);
 
-void sock_wait_add(sock_wait_t * wait, int tmo, sock_req_t * req);
+/**
+ * queue req on wait, the sem is created here on the first wait
+ * @return NET_ERR_NEED_WAIT, or the error when no sem can be had
+ */
+net_err_t sock_wait_add(sock_wait_t * wait, int tmo, sock_req_t * req);
 
 net_err_t sock_wait_enter(sock_wait_t * wait, int tmo);
 
@@ -183,6 +215,15 @@ net_err_t sock_recvfrom_req_in(struct func_msg_t * msg);
 //recv data
 net_err_t sock_recv_req_in(struct func_msg_t * msg);
 
+//send a batch of datagrams
+net_err_t sock_sendmmsg_req_in(struct func_msg_t * msg);
+
+//recv a batch of datagrams
+net_err_t sock_recvmmsg_req_in(struct func_msg_t * msg);
+
+//take a datagram for a zero copy view
+net_err_t sock_recv_view_req_in(struct func_msg_t * msg);
+
 //set sockopt
 net_err_t sock_setsockopt_req_in(struct func_msg_t * msg);
 
@@ -204,4 +245,10 @@ net_err_t sock_accept_req_in(struct func_msg_t * msg);
 //destroy socket
 net_err_t sock_destroy_req_in(struct func_msg_t * msg);
 
+/**
+ * rebuild the netif receive filter from the ports held by udp and tcp sockets,
+ * called whenever a socket takes or releases a local port
+ */
+void sock_filter_update(void);
+
 #endif //NET_SOCK_H
@@ -35,18 +35,25 @@
 #undef SOL_TCP
 #define SOL_TCP 1
 
+#undef SOL_UDP
+#define SOL_UDP 2
+
 #undef SO_SNDTIMEO
 #define SO_SNDTIMEO     1
 #undef SO_RCVTIMEO
 #define SO_RCVTIMEO     2
 #undef SO_KEEPALIVE
 #define SO_KEEPALIVE    3
+#undef SO_REUSEPORT
+#define SO_REUSEPORT    4
 #undef TCP_KEEPIDLE
 #define TCP_KEEPIDLE     4
 #undef TCP_KEEPINTVL
 #define TCP_KEEPINTVL    5
 #undef TCP_KEEPCNT
 #define TCP_KEEPCNT      6
+#undef UDP_SEGMENT
+#define UDP_SEGMENT      7
 
 typedef uint32_t x_in_addr_t;
 
@@ -83,6 +90,29 @@ struct x_sockaddr_in {
     char sin_zero[8];
 };
 
+//one datagram of x_sendmmsg / x_recvmmsg
+struct x_mmsghdr {
+    void * buf;
+    size_t len;
+    //peer address, may be null when sending on a connected socket
+    struct x_sockaddr * addr;
+    x_socklen_t addr_len;
+    //bytes sent or received
+    ssize_t comp_len;
+};
+
+/**
+ * read only view of a received datagram, walked with x_view_next.
+ * it points into the stack's buffers until x_recv_release
+ */
+struct x_recv_view {
+    size_t len;
+    struct x_sockaddr_in from;
+    //owned by the stack
+    pktbuf_t * buf;
+    pktblk_t * blk;
+};
+
 struct  x_hostent {
     char    * h_name;           /* official name of host */
     char    * h_aliases;        /* alias list */
@@ -124,6 +154,35 @@ ssize_t x_recvfrom(int s, const void * buf, size_t len, int flags, const struct
  */
 ssize_t x_recv(int s, const void * buf, size_t len, int flags);
 
+/**
+ * send up to cnt datagrams with one request to the worker
+ * @return count sent, -1 if none could be
+ */
+int x_sendmmsg(int s, struct x_mmsghdr * msgs, unsigned int cnt, int flags);
+
+/**
+ * wait for a datagram, then take up to cnt of those queued with one request to the worker
+ * @return count received, -1 on error
+ */
+int x_recvmmsg(int s, struct x_mmsghdr * msgs, unsigned int cnt, int flags);
+
+/**
+ * wait for a datagram and take it without copying
+ * @return its size, -1 on error
+ */
+ssize_t x_recv_view(int s, struct x_recv_view * view, int flags);
+
+/**
+ * next contiguous piece of the datagram
+ * @return its size, 0 at the end
+ */
+size_t x_view_next(struct x_recv_view * view, const void ** data);
+
+/**
+ * give the datagram of view back to the stack
+ */
+void x_recv_release(struct x_recv_view * view);
+
 /**
  * set socket opt
  */
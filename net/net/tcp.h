@@ -114,10 +114,33 @@ typedef enum {
     TCP_OSTATE_MAX
 } tcp_ostate_t;
 
+//a local port in use, shared by every tcp holding it
+typedef struct tcp_bind_t {
+    uint16_t port;
+    int ref;
+    node_t node;
+} tcp_bind_t;
+
 typedef struct tcp_t {
     sock_t base;
 
+    //listener of a child not yet accepted, child_node links its child_list
     struct tcp_t * parent;
+    node_t child_node;
+    //listener: children not yet accepted
+    list_t child_list;
+
+    //local port reference, taken once a port is set
+    tcp_bind_t * bind;
+    //port_node links the port table while there is no remote, conn_node the 4-tuple table after
+    list_t * port_bucket;
+    node_t port_node;
+    list_t * conn_bucket;
+    node_t conn_node;
+    //links the TIME_WAIT list, oldest first
+    node_t tw_node;
+    //links the list of senders waiting for send storage while flags.sbuf_wait
+    node_t sbuf_node;
 
     struct {
         uint32_t syn_out: 1;
@@ -126,11 +149,14 @@ typedef struct tcp_t {
         uint32_t irs_valid : 1;
         uint32_t keep_enable : 1;
         uint32_t inactive : 1;
+        uint32_t sbuf_wait : 1;
     } flags;
 
     tcp_state_t state;
 
     int mss;
+    //mss option of the peer, 0: not received
+    int mss_peer;
 
     struct {
         sock_wait_t wait;
@@ -144,8 +170,8 @@ typedef struct tcp_t {
     } conn;
 
     struct {
+        //storage is attached while the buffer holds data
         tcp_buf_t buf;
-        uint8_t data[TCP_SBUF_SIZE];
         //un ack
         uint32_t una;
         //next
@@ -167,7 +193,6 @@ typedef struct tcp_t {
 
     struct {
         tcp_buf_t buf;
-        uint8_t data[TCP_RBUF_SIZE];
         uint32_t nxt;
         uint32_t iss;
         sock_wait_t wait;
@@ -222,6 +247,11 @@ net_err_t tcp_abort(tcp_t * tcp, net_err_t err);
  */
 void tcp_read_options(tcp_t * tcp, tcp_hdr_t * tcp_hdr);
 
+/**
+ * follow the path mtu of the connection, never above the peer's mss
+ */
+void tcp_update_mss(tcp_t * tcp);
+
 /**
  * get tcp rcv window size
  */
@@ -257,4 +287,21 @@ tcp_t * tcp_create_child(tcp_t* tcp, tcp_seg_t * seg);
  */
 void tcp_free(tcp_t * tcp);
 
+/**
+ * attach storage to the snd or rcv buffer of tcp before data goes in
+ */
+net_err_t tcp_attach_buf(tcp_t * tcp, tcp_buf_t * buf);
+/**
+ * give the storage of the snd or rcv buffer back, the data left is dropped
+ */
+void tcp_detach_buf(tcp_t * tcp, tcp_buf_t * buf);
+/**
+ * follow tcp in and out of TIME_WAIT
+ */
+void tcp_timewait_track(tcp_t * tcp, int enter);
+/**
+ * add the local ports of tcp sockets to filter
+ */
+void tcp_filter_ports(netif_filter_t * filter);
+
 #endif //NET_TCP_H
@@ -34,7 +34,7 @@ net_err_t tcp_send_ack(tcp_t * tcp, tcp_seg_t * seg);
 /** send fin*/
 net_err_t tcp_send_fin(tcp_t * tcp);
 
-/** write snd buf*/
+/** write snd buf, -1 when no storage can be attached */
 int tcp_write_sndbuf(tcp_t* tcp, const uint8_t* buf, int len);
 
 /** transmit tcp data packet*/
@@ -17,10 +17,14 @@ typedef void (*timer_proc_t)(struct net_timer_t * timer, void * arg);
 
 //timer
 typedef struct net_timer_t {
-    char name[TIMER_NAME_SIZE];
+    //kept by reference, pass a string that outlives the timer
+    const char * name;
     int flags;
-    int curr;
+    //wheel time to fire at, in ms
+    uint32_t expire;
     int reload;
+    //wheel slot while pending, 0 otherwise
+    list_t * slot;
     //executed function
     timer_proc_t proc;
     //function args
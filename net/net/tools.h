@@ -44,6 +44,21 @@ net_err_t tools_init(void);
  */
 uint16_t checksum16(int offset, void * buf, uint16_t len, uint32_t pre_sum, int complement);
 
+/**
+ * update checksum after one 16 bit word changed from old to new, as in rfc 1624
+ */
+uint16_t checksum16_update(uint16_t checksum, uint16_t old, uint16_t new_word);
+
+/**
+ * hash of a connection, same value for both directions
+ */
+uint32_t flow_hash(const ipaddr_t * ip1, uint16_t port1, const ipaddr_t * ip2, uint16_t port2);
+
 uint16_t checksum_peso(pktbuf_t * buf, const ipaddr_t * dest, const ipaddr_t * src, uint8_t protocol);
 
+/**
+ * checksum with pseudo header over size bytes of buf from start
+ */
+uint16_t checksum_peso_at(pktbuf_t * buf, int start, int size, const ipaddr_t * dest, const ipaddr_t * src, uint8_t protocol);
+
 #endif //NET_TOOLS_H
@@ -35,6 +35,14 @@ typedef struct {
     sock_t base;
     list_t recv_list;
     sock_wait_t rcv_wait;
+
+    //base.node links the local port table once a port is bound, conn_node the 4-tuple table when connected
+    list_t * port_bucket;
+    list_t * conn_bucket;
+    node_t conn_node;
+
+    //UDP_SEGMENT: payload size of each datagram cut from one send, 0 if off
+    int gso_size;
 } udp_t;
 
 /**
@@ -49,8 +57,9 @@ sock_t * udp_create(int family, int protocol);
 
 /**
  * output udp packet
+ * @param dst destination cache of the sending socket, may be null
  */
-net_err_t udp_out(ipaddr_t * dest, uint16_t dport, ipaddr_t * src, uint16_t sport, pktbuf_t * buf);
+net_err_t udp_out(ipaddr_t * dest, uint16_t dport, ipaddr_t * src, uint16_t sport, pktbuf_t * buf, ip_dst_t * dst);
 
 /**
  * input udp packet
@@ -69,4 +78,9 @@ net_err_t udp_sendto(struct sock_t * s, const void * buf, size_t len, int flags,
 net_err_t udp_recvfrom(struct sock_t * s, void * buf, size_t len, int flags,
                        const struct x_sockaddr * src, x_socklen_t * src_len, ssize_t * result_len);
 
+/**
+ * add the local ports of udp sockets to filter
+ */
+void udp_filter_ports(netif_filter_t * filter);
+
 #endif //NET_UDP_H
@@ -15,7 +15,9 @@ static net_timer_t cache_timer;
 static arp_entry_t cache_tbl[ARP_TABLE_SIZE];
 static mblock_t cache_block;
 static list_t cache_list;
+static arp_entry_t * cache_hash[ARP_HASH_SIZE];
 static uint8_t empty_hwaddr[] = {0, 0, 0, 0, 0, 0};
+static arp_stats_t arp_stats;
 
 #if DEBUG_DISP_ENABLED(DEBUG_ARP)
 static void arp_pkt_display(arp_pkt_t * packet)
@@ -80,6 +82,7 @@ static void display_arp_tbl(void)
 static net_err_t arp_cache_init(void)
 {
     list_init(&cache_list);
+    plat_memset(cache_hash, 0, sizeof(cache_hash));
     net_err_t err = mblock_init(&cache_block, cache_tbl, sizeof(arp_entry_t), ARP_TABLE_SIZE, LOCKER_NONE);
     if (err < 0)
     {
@@ -117,19 +120,51 @@ static net_err_t cache_send_all(arp_entry_t * entry)
     return NET_ERR_OK;
 }
 
+static arp_entry_t ** cache_bucket(const uint8_t * ip)
+{
+    uint32_t hash = ((uint32_t)ip[0] << 24) | ((uint32_t)ip[1] << 16) | ((uint32_t)ip[2] << 8) | ip[3];
+    hash *= 0x9E3779B1;
+    return cache_hash + ((hash >> 16) % ARP_HASH_SIZE);
+}
+
+static void cache_hash_insert(arp_entry_t * entry)
+{
+    arp_entry_t ** bucket = cache_bucket(entry->paddr);
+    entry->hash_next = *bucket;
+    *bucket = entry;
+}
+
+static void cache_hash_remove(arp_entry_t * entry)
+{
+    arp_entry_t ** pre = cache_bucket(entry->paddr);
+    while (*pre)
+    {
+        if (*pre == entry)
+        {
+            *pre = entry->hash_next;
+            break;
+        }
+        pre = &(*pre)->hash_next;
+    }
+    entry->hash_next = (arp_entry_t *)0;
+}
+
 static arp_entry_t * cache_alloc(int force)
 {
     arp_entry_t * entry = mblock_alloc(&cache_block, -1);
     if (!entry && force)
     {
-        node_t * node = list_remove_first(&cache_list);
+        //reuse the least recently used entry
+        node_t * node = list_remove_last(&cache_list);
         if (!node)
         {
             debug_warn(DEBUG_ARP, "alloc arp entry failed");
             return (arp_entry_t *)0;
         }
         entry = list_node_parent(node, arp_entry_t, node);
+        cache_hash_remove(entry);
         cache_clear_all(entry);
+        ipv4_dst_invalidate();
     }
 
     if (entry)
@@ -149,20 +184,24 @@ static arp_entry_t * cache_alloc(int force)
 static void cache_free(arp_entry_t * entry)
 {
     cache_clear_all(entry);
+    cache_hash_remove(entry);
     list_remove(&cache_list, &entry->node);
     mblock_free(&cache_block, entry);
+    //sockets may hold a link header built from it
+    ipv4_dst_invalidate();
 }
 
 static arp_entry_t * cache_find(uint8_t * ip)
 {
-    node_t * node;
-    list_for_each(node, &cache_list)
+    for (arp_entry_t * entry = *cache_bucket(ip); entry; entry = entry->hash_next)
     {
-        arp_entry_t * entry = list_node_parent(node, arp_entry_t, node);
         if (plat_memcmp(ip, entry->paddr, IPV4_ADDR_SIZE) == 0)
         {
-            list_remove(&cache_list, &entry->node);
-            list_insert_first(&cache_list, &entry->node);
+            if (list_first(&cache_list) != &entry->node)
+            {
+                list_remove(&cache_list, &entry->node);
+                list_insert_first(&cache_list, &entry->node);
+            }
             return entry;
         }
     }
@@ -202,15 +241,16 @@ static net_err_t cache_insert(netif_t * netif, uint8_t * ip, uint8_t * hwaddr, i
         }
         cache_entry_set(entry, hwaddr, ip, netif, NET_ARP_RESOLVED);
         list_insert_first(&cache_list, &entry->node);
+        cache_hash_insert(entry);
     }
     else
     {
-        cache_entry_set(entry, hwaddr, ip, netif, NET_ARP_RESOLVED);
-        if (list_first(&cache_list) != &entry->node)
+        if ((entry->state == NET_ARP_RESOLVED) && plat_memcmp(entry->hwaddr, hwaddr, ETHER_HWA_SIZE))
         {
-            list_remove(&cache_list, &entry->node);
-            list_insert_first(&cache_list, &entry->node);
+            ipv4_dst_invalidate();
         }
+        //cache_find has already moved it to the front
+        cache_entry_set(entry, hwaddr, ip, netif, NET_ARP_RESOLVED);
 
         net_err_t err = cache_send_all(entry);
         if (err < 0)
@@ -441,6 +481,7 @@ net_err_t arp_resolve(netif_t * netif, const ipaddr_t * ipaddr, pktbuf_t * buf)
         }
         cache_entry_set(entry, empty_hwaddr, (uint8_t *) ip_buf, netif, NET_ARP_WAITING);
         list_insert_first(&cache_list, &entry->node);
+        cache_hash_insert(entry);
         list_insert_last(&entry->buf_list, &buf->node);
         display_arp_tbl();
 
@@ -457,7 +498,7 @@ void arp_clear(netif_t * netif)
         arp_entry_t * entry = list_node_parent(node, arp_entry_t, node);
         if (entry->netif == netif)
         {
-            list_remove(&cache_list, node);
+            cache_free(entry);
         }
     }
 }
@@ -493,5 +534,21 @@ void arp_update_from_ipbuf(netif_t * netif, pktbuf_t * buf)
         debug_warn(DEBUG_ARP, "not ipv4");
         return;
     }
+
+    //nothing would change for an entry refreshed just now with the same hwaddr
+    arp_entry_t * entry = cache_find(ipv4_hdr->src_ip);
+    if (entry && (entry->state == NET_ARP_RESOLVED) && (entry->netif == netif)
+        && (entry->tmo > to_scan_cnt(ARP_ENTRY_STABLE_TMO - ARP_ENTRY_REFRESH_TMO))
+        && !plat_memcmp(entry->hwaddr, hdr->src, ETHER_HWA_SIZE))
+    {
+        arp_stats.refresh_skip++;
+        return;
+    }
+    arp_stats.refresh_update++;
     cache_insert(netif, ipv4_hdr->src_ip, hdr->src, 0);
+}
+
+void arp_get_stats(arp_stats_t * stats)
+{
+    *stats = arp_stats;
 }
\ No newline at end of file
@@ -11,9 +11,11 @@
 #include "arp.h"
 #include "ipv4.h"
 
-static net_err_t is_pkt_ok(ether_pkt_t * pkt, int size)
+static net_err_t is_pkt_ok(netif_t * netif, pktbuf_t * buf, int size)
 {
-    if (size > (sizeof(ether_hdr_t) + ETHER_MTU))
+    //frames merged by gro are bounded by gro, not by the mtu
+    int mtu = buf->gro ? NETIF_GRO_MAX_SIZE : (netif->mtu ? netif->mtu : NETIF_MTU_MAX);
+    if (size > (sizeof(ether_hdr_t) + mtu))
     {
         return NET_ERR_SIZE;
     }
@@ -66,7 +68,7 @@ net_err_t ether_in(struct netif_t * netif, pktbuf_t * buf)
     pktbuf_set_cont(buf, sizeof(ether_hdr_t));
     ether_pkt_t * pkt = (ether_pkt_t*) pktbuf_data(buf);
     net_err_t err;
-    if ((err = is_pkt_ok(pkt, buf->total_size)) < 0)
+    if ((err = is_pkt_ok(netif, buf, buf->total_size)) < 0)
     {
         debug_warn(DEBUG_ETHER, "ether pkt error");
         return err;
@@ -145,14 +147,13 @@ const uint8_t * ether_broadcast_addr(void)
     return broadcast;
 }
 
-net_err_t ether_raw_out(netif_t * netif, uint16_t protocol, const uint8_t * dest, pktbuf_t * buf)
+static net_err_t ether_pad(pktbuf_t * buf)
 {
-    net_err_t err;
     int size = pktbuf_total(buf);
     if (size < ETHER_DATA_MIN)
     {
         debug_info(DEBUG_ETHER, "resize from %d to %d", size, ETHER_DATA_MIN);
-        err = pktbuf_resize(buf, ETHER_DATA_MIN);
+        net_err_t err = pktbuf_resize(buf, ETHER_DATA_MIN);
         if (err < 0)
         {
             debug_error(DEBUG_ETHER, "resize failed");
@@ -161,7 +162,16 @@ net_err_t ether_raw_out(netif_t * netif, uint16_t protocol, const uint8_t * dest
         pktbuf_reset_access(buf);
         pktbuf_seek(buf, size);
         pktbuf_fill(buf, 0, ETHER_DATA_MIN - size);
-        size = ETHER_DATA_MIN;
+    }
+    return NET_ERR_OK;
+}
+
+net_err_t ether_raw_out(netif_t * netif, uint16_t protocol, const uint8_t * dest, pktbuf_t * buf)
+{
+    net_err_t err = ether_pad(buf);
+    if (err < 0)
+    {
+        return err;
     }
 
     err = pktbuf_add_header(buf, sizeof(ether_hdr_t), 1);
@@ -175,7 +185,7 @@ net_err_t ether_raw_out(netif_t * netif, uint16_t protocol, const uint8_t * dest
     plat_memcpy(pkt->hdr.src, netif->hwaddr.addr, ETHER_HWA_SIZE);
     pkt->hdr.protocol = x_htons(protocol);
 
-    display_ether_pkt("ether out", pkt, size);
+    display_ether_pkt("ether out", pkt, buf->total_size);
     if (plat_memcmp(netif->hwaddr.addr, dest, ETHER_HWA_SIZE) == 0)
     {
         return netif_put_in(netif, buf, -1);
@@ -192,4 +202,36 @@ net_err_t ether_raw_out(netif_t * netif, uint16_t protocol, const uint8_t * dest
     }
 }
 
+int ether_hdr_build(netif_t * netif, uint16_t protocol, const uint8_t * dest, uint8_t * hdr)
+{
+    ether_hdr_t * ether_hdr = (ether_hdr_t *) hdr;
+    plat_memcpy(ether_hdr->dest, dest, ETHER_HWA_SIZE);
+    plat_memcpy(ether_hdr->src, netif->hwaddr.addr, ETHER_HWA_SIZE);
+    ether_hdr->protocol = x_htons(protocol);
+    return sizeof(ether_hdr_t);
+}
 
+net_err_t ether_hdr_out(netif_t * netif, const uint8_t * hdr, pktbuf_t * buf)
+{
+    net_err_t err = ether_pad(buf);
+    if (err < 0)
+    {
+        return err;
+    }
+
+    err = pktbuf_add_header(buf, sizeof(ether_hdr_t), 1);
+    if (err < 0)
+    {
+        debug_error(DEBUG_ETHER, "add header failed: %d", err);
+        return NET_ERR_SIZE;
+    }
+    plat_memcpy(pktbuf_data(buf), hdr, sizeof(ether_hdr_t));
+
+    err = netif_put_out(netif, buf, -1);
+    if (err < 0)
+    {
+        debug_error(DEBUG_ETHER, "put pkt out failed: %d", err);
+        return err;
+    }
+    return netif->ops->xmit(netif);
+}
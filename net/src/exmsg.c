@@ -8,6 +8,7 @@
 #include "mblock.h"
 #include "timer.h"
 #include "ipv4.h"
+#include "gro.h"
 
 static void * msg_tbl[EXMSG_MSG_CNT];
 static fixq_t msg_queue;
@@ -81,33 +82,52 @@ net_err_t exmsg_init(void)
     return NET_ERR_OK;
 }
 
+static int get_in_batch(netif_t * netif, int qid, pktbuf_t ** bufs)
+{
+    int cnt = 0;
+    while ((cnt < NETIF_GRO_BATCH) && (bufs[cnt] = netif_get_in_queue(netif, qid, -1)))
+    {
+        cnt++;
+    }
+    return cnt;
+}
+
 static net_err_t do_netif_in (exmsg_t * msg)
 {
     netif_t * netif = msg->netif.netif;
+    netif_poll_in_update(netif);
 
-    pktbuf_t * buf;
-    while ((buf = netif_get_in(netif, -1)))
+    pktbuf_t * bufs[NETIF_GRO_BATCH];
+    int cnt;
+    while ((cnt = get_in_batch(netif, msg->netif.qid, bufs)) > 0)
     {
-        debug_info(DEBUG_MSG, "recv a packet");
-
-        if (netif->link_layer)
+        //merge in-order tcp segments before they go up the stack
+        cnt = gro_merge(netif, bufs, cnt);
+        for (int i = 0; i < cnt; i++)
         {
-            net_err_t err = netif->link_layer->in(netif, buf);
-            if (err < 0)
+            pktbuf_t * buf = bufs[i];
+            pktbuf_reset_access(buf);
+            debug_info(DEBUG_MSG, "recv a packet");
+
+            if (netif->link_layer)
             {
-                pktbuf_free(buf);
-                debug_warn(DEBUG_MSG, "netif in failed, error=%d", err);
+                net_err_t err = netif->link_layer->in(netif, buf);
+                if (err < 0)
+                {
+                    pktbuf_free(buf);
+                    debug_warn(DEBUG_MSG, "netif in failed, error=%d", err);
+                }
             }
-        }
-        else
-        {
-            net_err_t err = ipv4_in(netif, buf);
-            if (err < 0)
+            else
             {
-                pktbuf_free(buf);
-                debug_warn(DEBUG_MSG, "ipv4 in failed, error=%d", err);
-            }
+                net_err_t err = ipv4_in(netif, buf);
+                if (err < 0)
+                {
+                    pktbuf_free(buf);
+                    debug_warn(DEBUG_MSG, "ipv4 in failed, error=%d", err);
+                }
 
+            }
         }
     }
     return NET_ERR_OK;
@@ -128,7 +148,17 @@ static void work_thread(void * arg)
     while (1)
     {
         int first_time = net_timer_first_tmo();
-        exmsg_t * msg = (exmsg_t *) fixq_recv(&msg_queue, first_time);
+        //spin a while before sleeping if some netif is in busy poll mode
+        int budget = netif_poll_budget();
+        exmsg_t * msg = budget ? (exmsg_t *) fixq_poll(&msg_queue, budget) : (exmsg_t *)0;
+        if (budget && !msg)
+        {
+            netif_poll_in_idle();
+        }
+        if (!msg)
+        {
+            msg = (exmsg_t *) fixq_recv(&msg_queue, first_time);
+        }
         if (msg) {
             debug_info(DEBUG_MSG, "recv a msg");
 
@@ -147,10 +177,11 @@ static void work_thread(void * arg)
         }
         int diff_ms = sys_time_goes(&time);
         net_timer_check_tmo(diff_ms);
+        ipv4_local_poll();
     }
 }
 
-net_err_t exmsg_netif_in(netif_t * netif)
+net_err_t exmsg_netif_in(netif_t * netif, int qid)
 {
     exmsg_t * msg = mblock_alloc(&msg_block, -1);
     if (!msg)
@@ -161,6 +192,7 @@ net_err_t exmsg_netif_in(netif_t * netif)
 
     msg->type = NET_EXMSG_NETIF_IN;
     msg->netif.netif = netif;
+    msg->netif.qid = qid;
 
     net_err_t err = fixq_send(&msg_queue, msg, -1);
     if (err < 0)
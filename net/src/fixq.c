@@ -76,6 +76,35 @@ net_err_t fixq_send(fixq_t * q, void * msg, int ms)
     return NET_ERR_OK;
 }
 
+int fixq_send_burst(fixq_t * q, void ** msgs, int cnt)
+{
+    locker_lock(&q->locker);
+    int free_cnt = q->size - q->cnt;
+    locker_unlock(&q->locker);
+
+    if (cnt > free_cnt)
+    {
+        cnt = free_cnt;
+    }
+
+    int n = sys_sem_take(q->send_sem, cnt);
+
+    locker_lock(&q->locker);
+    for (int i = 0; i < n; i++)
+    {
+        q->buf[q->in++] = msgs[i];
+        if (q->in >= q->size)
+        {
+            q->in = 0;
+        }
+    }
+    q->cnt += n;
+    locker_unlock(&q->locker);
+
+    sys_sem_notify_cnt(q->recv_sem, n);
+    return n;
+}
+
 void * fixq_recv(fixq_t * q, int ms)
 {
     locker_lock(&q->locker);
@@ -102,6 +131,24 @@ void * fixq_recv(fixq_t * q, int ms)
     return msg;
 }
 
+void * fixq_poll(fixq_t * q, int us)
+{
+    uint32_t start = sys_time_us();
+    do
+    {
+        //peek without the lock, only take it once something is queued
+        if (fixq_peek(q))
+        {
+            void * msg = fixq_recv(q, -1);
+            if (msg)
+            {
+                return msg;
+            }
+        }
+    } while ((int)(sys_time_us() - start) < us);
+    return (void *)0;
+}
+
 void fixq_destroy(fixq_t * q)
 {
     locker_destroy(&q->locker);
@@ -0,0 +1,210 @@
+//
+// Created by wj on 2024/6/21.
+//
+
+#include "gro.h"
+#include "debug.h"
+#include "tools.h"
+#include "ether.h"
+#include "ipv4.h"
+#include "tcp.h"
+#include "protocol.h"
+
+//segment being grown for one flow
+typedef struct {
+    pktbuf_t * buf;
+    uint8_t src_ip[IPV4_ADDR_SIZE];
+    uint8_t dest_ip[IPV4_ADDR_SIZE];
+    //ports in network order
+    uint16_t sport, dport;
+    //seq expected for the next segment
+    uint32_t next_seq;
+    //ack and window of the head in network order, segments changing them are not merged
+    uint32_t ack;
+    uint16_t win;
+    //head ends with a psh segment, nothing more is merged behind it
+    int psh;
+} gro_flow_t;
+
+static int link_hdr_size(netif_t * netif)
+{
+    return (netif->type == NETIF_TYPE_ETHER) ? (int)sizeof(ether_hdr_t) : 0;
+}
+
+/**
+ * check whether buf is a plain in-order-mergeable tcp data segment with good checksums
+ * @return data size of the segment, 0 if buf can not be merged
+ */
+static int gro_parse(netif_t * netif, pktbuf_t * buf, int link_size)
+{
+    if (netif->type == NETIF_TYPE_ETHER)
+    {
+        if (pktbuf_set_cont(buf, link_size) < 0)
+        {
+            return 0;
+        }
+        ether_hdr_t * ether_hdr = (ether_hdr_t *) pktbuf_data(buf);
+        if (x_ntohs(ether_hdr->protocol) != NET_PROTOCOL_IPV4)
+        {
+            return 0;
+        }
+    }
+
+    int hdr_size = link_size + sizeof(ipv4_hdr_t) + sizeof(tcp_hdr_t);
+    if ((buf->total_size <= hdr_size) || (pktbuf_set_cont(buf, hdr_size) < 0))
+    {
+        return 0;
+    }
+
+    ipv4_pkt_t * ip_pkt = (ipv4_pkt_t *) (pktbuf_data(buf) + link_size);
+    int ip_total = x_ntohs(ip_pkt->hdr.total_len);
+    if ((ip_pkt->hdr.version != NET_VERSION_IPV4)
+        || (ipv4_hdr_size(ip_pkt) != sizeof(ipv4_hdr_t))
+        || (ip_pkt->hdr.protocol != NET_PROTOCOL_TCP)
+        || (x_ntohs(ip_pkt->hdr.frag_all) & IP_FRAG_MASK)
+        || (ip_total <= hdr_size - link_size)
+        || (ip_total > buf->total_size - link_size))
+    {
+        return 0;
+    }
+
+    tcp_hdr_t * tcp_hdr = (tcp_hdr_t *) ip_pkt->data;
+    if ((tcp_hdr_size(tcp_hdr) != sizeof(tcp_hdr_t))
+        || !tcp_hdr->f_ack || tcp_hdr->f_syn || tcp_hdr->f_fin || tcp_hdr->f_rst || tcp_hdr->f_urg)
+    {
+        return 0;
+    }
+
+    //drop ether padding, then verify once here so tcp_in does not need to
+    if (pktbuf_resize(buf, link_size + ip_total) < 0)
+    {
+        return 0;
+    }
+    if (ip_pkt->hdr.header_checksum && checksum16(0, ip_pkt, sizeof(ipv4_hdr_t), 0, 1))
+    {
+        return 0;
+    }
+    if (tcp_hdr->checksum && !buf->csum_valid)
+    {
+        ipaddr_t src, dest;
+        ipaddr_from_buf(&src, ip_pkt->hdr.src_ip);
+        ipaddr_from_buf(&dest, ip_pkt->hdr.dest_ip);
+        if (checksum_peso_at(buf, link_size + sizeof(ipv4_hdr_t), ip_total - sizeof(ipv4_hdr_t),
+                             &dest, &src, NET_PROTOCOL_TCP))
+        {
+            return 0;
+        }
+        buf->csum_valid = 1;
+    }
+    return ip_total - (hdr_size - link_size);
+}
+
+static int gro_flow_match(gro_flow_t * flow, ipv4_pkt_t * ip_pkt, tcp_hdr_t * tcp_hdr)
+{
+    return flow->buf
+           && (flow->sport == tcp_hdr->sport) && (flow->dport == tcp_hdr->dport)
+           && !plat_memcmp(flow->src_ip, ip_pkt->hdr.src_ip, IPV4_ADDR_SIZE)
+           && !plat_memcmp(flow->dest_ip, ip_pkt->hdr.dest_ip, IPV4_ADDR_SIZE);
+}
+
+static void gro_flow_start(gro_flow_t * flow, pktbuf_t * buf, ipv4_pkt_t * ip_pkt, tcp_hdr_t * tcp_hdr, int data_size)
+{
+    flow->buf = buf;
+    plat_memcpy(flow->src_ip, ip_pkt->hdr.src_ip, IPV4_ADDR_SIZE);
+    plat_memcpy(flow->dest_ip, ip_pkt->hdr.dest_ip, IPV4_ADDR_SIZE);
+    flow->sport = tcp_hdr->sport;
+    flow->dport = tcp_hdr->dport;
+    flow->next_seq = x_ntohl(tcp_hdr->seq) + data_size;
+    flow->ack = tcp_hdr->ack;
+    flow->win = tcp_hdr->win;
+    flow->psh = tcp_hdr->f_psh;
+}
+
+/**
+ * buf continues flow's segment without carrying an ack advance or window update tcp_in must see
+ */
+static int gro_flow_next(gro_flow_t * flow, tcp_hdr_t * tcp_hdr)
+{
+    return !flow->psh && (x_ntohl(tcp_hdr->seq) == flow->next_seq)
+           && (tcp_hdr->ack == flow->ack) && (tcp_hdr->win == flow->win);
+}
+
+/**
+ * append the data of buf to flow's segment, a psh on buf closes the flow
+ */
+static int gro_flow_append(gro_flow_t * flow, pktbuf_t * buf, int link_size, int data_size)
+{
+    pktbuf_t * head = flow->buf;
+    ipv4_pkt_t * head_ip = (ipv4_pkt_t *) (pktbuf_data(head) + link_size);
+    int head_total = x_ntohs(head_ip->hdr.total_len);
+    if (head_total + data_size > NETIF_GRO_MAX_SIZE)
+    {
+        return 0;
+    }
+
+    tcp_hdr_t * tcp_hdr = (tcp_hdr_t *) (pktbuf_data(buf) + link_size + sizeof(ipv4_hdr_t));
+    tcp_hdr_t * head_tcp = (tcp_hdr_t *) head_ip->data;
+    head_tcp->f_psh = tcp_hdr->f_psh;
+    flow->psh = tcp_hdr->f_psh;
+
+    head_ip->hdr.total_len = x_htons(head_total + data_size);
+    head_ip->hdr.header_checksum = 0;
+    head_ip->hdr.header_checksum = checksum16(0, head_ip, sizeof(ipv4_hdr_t), 0, 1);
+
+    pktbuf_remove_header(buf, link_size + sizeof(ipv4_hdr_t) + sizeof(tcp_hdr_t));
+    pktbuf_merge(head, buf);
+    //mark head as a merged frame, it may now exceed the mtu
+    head->gro = 1;
+    head->gso_segs = head->gso_segs ? head->gso_segs + 1 : 2;
+    flow->next_seq += data_size;
+    return 1;
+}
+
+int gro_merge(netif_t * netif, pktbuf_t ** bufs, int cnt)
+{
+    gro_flow_t flows[NETIF_GRO_FLOWS];
+    plat_memset(flows, 0, sizeof(flows));
+    int next_flow = 0;
+
+    int link_size = link_hdr_size(netif);
+    int out = 0;
+    for (int i = 0; i < cnt; i++)
+    {
+        pktbuf_t * buf = bufs[i];
+        int data_size = gro_parse(netif, buf, link_size);
+        if (!data_size)
+        {
+            //may be a fin or rst of a flow being merged, later segments must not pass it
+            plat_memset(flows, 0, sizeof(flows));
+            bufs[out++] = buf;
+            continue;
+        }
+
+        ipv4_pkt_t * ip_pkt = (ipv4_pkt_t *) (pktbuf_data(buf) + link_size);
+        tcp_hdr_t * tcp_hdr = (tcp_hdr_t *) ip_pkt->data;
+        gro_flow_t * flow = (gro_flow_t *)0;
+        for (int j = 0; j < NETIF_GRO_FLOWS; j++)
+        {
+            if (gro_flow_match(flows + j, ip_pkt, tcp_hdr))
+            {
+                flow = flows + j;
+                break;
+            }
+        }
+
+        if (flow && gro_flow_next(flow, tcp_hdr)
+            && gro_flow_append(flow, buf, link_size, data_size))
+        {
+            continue;
+        }
+
+        if (!flow)
+        {
+            flow = flows + next_flow;
+            next_flow = (next_flow + 1) % NETIF_GRO_FLOWS;
+        }
+        gro_flow_start(flow, buf, ip_pkt, tcp_hdr, data_size);
+        bufs[out++] = buf;
+    }
+    return out;
+}
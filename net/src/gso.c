@@ -0,0 +1,151 @@
+//
+// Created by wj on 2024/6/20.
+//
+
+#include "gso.h"
+#include "debug.h"
+#include "tools.h"
+#include "ether.h"
+#include "ipv4.h"
+#include "tcp.h"
+#include "udp.h"
+#include "protocol.h"
+
+static int link_hdr_size(netif_t * netif)
+{
+    return (netif->type == NETIF_TYPE_ETHER) ? (int)sizeof(ether_hdr_t) : 0;
+}
+
+/**
+ * build one segment: copy of the headers followed by size bytes of payload from offset
+ */
+static pktbuf_t * gso_alloc_seg(pktbuf_t * buf, int hdr_size, int offset, int size, int min_size)
+{
+    pktbuf_t * seg = pktbuf_alloc(hdr_size);
+    if (!seg)
+    {
+        return (pktbuf_t *)0;
+    }
+
+    int total = hdr_size + size;
+    if (pktbuf_resize(seg, total < min_size ? min_size : total) < 0)
+    {
+        pktbuf_free(seg);
+        return (pktbuf_t *)0;
+    }
+
+    pktbuf_reset_access(buf);
+    pktbuf_reset_access(seg);
+    pktbuf_copy(seg, buf, hdr_size);
+    pktbuf_seek(buf, hdr_size + offset);
+    pktbuf_copy(seg, buf, size);
+    if (total < min_size)
+    {
+        pktbuf_fill(seg, 0, min_size - total);
+    }
+    seg->flow_hash = buf->flow_hash;
+    return seg;
+}
+
+net_err_t gso_put_out(netif_t * netif, pktbuf_t * buf, int tmo)
+{
+    int link_size = link_hdr_size(netif);
+    int min_size = link_size ? link_size + ETHER_DATA_MIN : 0;
+
+    net_err_t err = pktbuf_set_cont(buf, link_size + sizeof(ipv4_hdr_t));
+    if (err < 0)
+    {
+        debug_error(DEBUG_NETIF, "gso set ip cont failed");
+        return err;
+    }
+    ipv4_pkt_t * ip_pkt = (ipv4_pkt_t *) (pktbuf_data(buf) + link_size);
+    int ip_size = ipv4_hdr_size(ip_pkt);
+
+    int is_tcp = ip_pkt->hdr.protocol == NET_PROTOCOL_TCP;
+    int l4_size = sizeof(udp_hdr_t);
+    if (is_tcp)
+    {
+        err = pktbuf_set_cont(buf, link_size + ip_size + sizeof(tcp_hdr_t));
+        if (err < 0)
+        {
+            debug_error(DEBUG_NETIF, "gso set tcp cont failed");
+            return err;
+        }
+        tcp_hdr_t * tcp_hdr = (tcp_hdr_t *) (pktbuf_data(buf) + link_size + ip_size);
+        l4_size = tcp_hdr_size(tcp_hdr);
+    }
+    int hdr_size = link_size + ip_size + l4_size;
+    err = pktbuf_set_cont(buf, hdr_size);
+    if (err < 0)
+    {
+        debug_error(DEBUG_NETIF, "gso set hdr cont failed");
+        return err;
+    }
+    ip_pkt = (ipv4_pkt_t *) (pktbuf_data(buf) + link_size);
+    tcp_hdr_t * tcp_hdr = (tcp_hdr_t *) (pktbuf_data(buf) + link_size + ip_size);
+
+    ipaddr_t src, dest;
+    ipaddr_from_buf(&src, ip_pkt->hdr.src_ip);
+    ipaddr_from_buf(&dest, ip_pkt->hdr.dest_ip);
+
+    int data_size = x_ntohs(ip_pkt->hdr.total_len) - (hdr_size - link_size);
+    uint16_t id = x_ntohs(ip_pkt->hdr.id);
+    uint32_t seq = is_tcp ? x_ntohl(tcp_hdr->seq) : 0;
+    int last_fin = is_tcp && tcp_hdr->f_fin;
+    int last_psh = is_tcp && tcp_hdr->f_psh;
+
+    for (int offset = 0; offset < data_size; offset += buf->gso_size)
+    {
+        int size = data_size - offset;
+        int last = size <= buf->gso_size;
+        if (!last)
+        {
+            size = buf->gso_size;
+        }
+
+        pktbuf_t * seg = gso_alloc_seg(buf, hdr_size, offset, size, min_size);
+        if (!seg)
+        {
+            debug_error(DEBUG_NETIF, "gso alloc segment failed");
+            return NET_ERR_MEM;
+        }
+
+        //fix up ip header
+        ipv4_pkt_t * seg_ip = (ipv4_pkt_t *) (pktbuf_data(seg) + link_size);
+        seg_ip->hdr.total_len = x_htons(hdr_size - link_size + size);
+        seg_ip->hdr.id = x_htons(id++);
+        seg_ip->hdr.header_checksum = 0;
+        seg_ip->hdr.header_checksum = checksum16(0, seg_ip, ip_size, 0, 1);
+
+        if (is_tcp)
+        {
+            //fix up tcp header, fin and psh only go with the last segment
+            tcp_hdr_t * seg_tcp = (tcp_hdr_t *) ((uint8_t *)seg_ip + ip_size);
+            seg_tcp->seq = x_htonl(seq + offset);
+            seg_tcp->f_fin = last ? last_fin : 0;
+            seg_tcp->f_psh = last ? last_psh : 0;
+            seg_tcp->checksum = 0;
+            seg_tcp->checksum = checksum_peso_at(seg, link_size + ip_size, l4_size + size,
+                                                 &dest, &src, NET_PROTOCOL_TCP);
+        }
+        else
+        {
+            //each udp segment is a datagram of its own
+            udp_hdr_t * seg_udp = (udp_hdr_t *) ((uint8_t *)seg_ip + ip_size);
+            seg_udp->total_len = x_htons(l4_size + size);
+            seg_udp->checksum = 0;
+            seg_udp->checksum = checksum_peso_at(seg, link_size + ip_size, l4_size + size,
+                                                 &dest, &src, NET_PROTOCOL_UDP);
+        }
+
+        err = netif_put_out(netif, seg, tmo);
+        if (err < 0)
+        {
+            pktbuf_free(seg);
+            return err;
+        }
+    }
+
+    pktbuf_free(buf);
+    return NET_ERR_OK;
+}
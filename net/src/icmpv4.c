@@ -7,6 +7,16 @@
 #include "ipv4.h"
 #include "protocol.h"
 #include "raw.h"
+#include "tools.h"
+#include "sys_plat.h"
+
+static icmp_bucket_t echo_bucket, unreach_bucket, time_exceeded_bucket;
+//per dest buckets, indexed by a hash of the dest
+static icmp_bucket_t src_buckets[ICMP_RATE_SRC_NR];
+static icmpv4_stats_t icmp_stats;
+//ms since init, clock of all buckets
+static uint32_t rate_clock;
+static net_time_t rate_time;
 
 #if DEBUG_DISP_ENABLED(DEBUG_ICMP)
 static void display_icmp_pkt(char * title, icmp_pkt_t * pkt)
@@ -20,9 +30,109 @@ static void display_icmp_pkt(char * title, icmp_pkt_t * pkt)
 #define display_icmp_pkt(title, pkt);
 #endif
 
+static void bucket_init(icmp_bucket_t * bucket, int rate, int burst)
+{
+    bucket->rate = rate;
+    bucket->burst = burst;
+    bucket->tokens = burst * 1000;
+    bucket->last = rate_clock;
+}
+
+/**
+ * refill bucket for the time gone
+ * @return 1 if it holds a whole message, taken if take is set
+ */
+static int bucket_take(icmp_bucket_t * bucket, int take)
+{
+    if (!bucket->rate)
+    {
+        return 1;
+    }
+
+    int64_t tokens = bucket->tokens + (int64_t)(rate_clock - bucket->last) * bucket->rate;
+    int64_t max = (int64_t)bucket->burst * 1000;
+    bucket->tokens = (int)(tokens > max ? max : tokens);
+    bucket->last = rate_clock;
+    if (bucket->tokens < 1000)
+    {
+        return 0;
+    }
+    if (take)
+    {
+        bucket->tokens -= 1000;
+    }
+    return 1;
+}
+
+static icmp_bucket_t * type_bucket(uint8_t type)
+{
+    switch (type) {
+        case ICMPv4_ECHO_REPLY:
+            return &echo_bucket;
+        case ICMPv4_UNREACHABLE:
+            return &unreach_bucket;
+        case ICMPv4_TIME_EXCEEDED:
+            return &time_exceeded_bucket;
+        default:
+            return (icmp_bucket_t *)0;
+    }
+}
+
+/**
+ * @return 1 if a message of type may be sent to dest now, both its type and dest bucket pay for it
+ */
+static int icmpv4_rate_ok(uint8_t type, ipaddr_t * dest)
+{
+    rate_clock += sys_time_goes(&rate_time);
+
+    //a colliding dest shares the slot's tokens, so spreading a flood over addresses can't refill it
+    uint32_t hash = dest->q_addr * 0x9E3779B1;
+    icmp_bucket_t * src = src_buckets + ((hash >> 16) % ICMP_RATE_SRC_NR);
+
+    icmp_bucket_t * bucket = type_bucket(type);
+    if (!bucket_take(src, 0) || (bucket && !bucket_take(bucket, 1)))
+    {
+        icmp_stats.rate_limited++;
+        return 0;
+    }
+    bucket_take(src, 1);
+    return 1;
+}
+
+net_err_t icmpv4_set_rate(uint8_t type, int rate, int burst)
+{
+    icmp_bucket_t * bucket = type_bucket(type);
+    if (!bucket || (rate < 0) || (burst < 1))
+    {
+        return NET_ERR_PARAM;
+    }
+    bucket_init(bucket, rate, burst);
+    return NET_ERR_OK;
+}
+
+void icmpv4_set_src_rate(int rate, int burst)
+{
+    for (int i = 0; i < ICMP_RATE_SRC_NR; i++)
+    {
+        bucket_init(src_buckets + i, rate, burst);
+    }
+}
+
+void icmpv4_get_stats(icmpv4_stats_t * stats)
+{
+    *stats = icmp_stats;
+}
+
 net_err_t icmpv4_init()
 {
     debug_info(DEBUG_ICMP, "icmp init");
+    rate_clock = 0;
+    sys_time_curr(&rate_time);
+    plat_memset(&icmp_stats, 0, sizeof(icmp_stats));
+    bucket_init(&echo_bucket, ICMP_RATE_ECHO, ICMP_RATE_BURST);
+    bucket_init(&unreach_bucket, ICMP_RATE_ERROR, ICMP_RATE_BURST);
+    bucket_init(&time_exceeded_bucket, ICMP_RATE_ERROR, ICMP_RATE_BURST);
+    icmpv4_set_src_rate(ICMP_RATE_SRC, ICMP_RATE_SRC_BURST);
     return NET_ERR_OK;
 }
 
@@ -33,6 +143,11 @@ static net_err_t is_pkt_ok(icmp_pkt_t * icmp_pkt, int total_size, pktbuf_t * buf
         debug_warn(DEBUG_ICMP, "size error");
         return NET_ERR_SIZE;
     }
+    if (buf->csum_valid)
+    {
+        return NET_ERR_OK;
+    }
+
     uint16_t checksum = pktbuf_checksum16(buf, total_size, 0, 1);
     if (checksum != 0)
     {
@@ -59,6 +174,30 @@ static net_err_t icmpv4_echo_reply(ipaddr_t * dest, ipaddr_t * src, pktbuf_t * b
     return icmpv4_out(dest, src, buf);
 }
 
+/**
+ * a router dropped one of our DF datagrams, remember the smaller path mtu
+ */
+static void icmpv4_frag_needed(pktbuf_t * buf, int iphdr_size)
+{
+    int size = iphdr_size + sizeof(icmpv4_hdr_t) + 4 + sizeof(ipv4_hdr_t);
+    if ((buf->total_size < size) || (pktbuf_set_cont(buf, size) < 0))
+    {
+        return;
+    }
+
+    icmp_pkt_t * icmp_pkt = (icmp_pkt_t *) (pktbuf_data(buf) + iphdr_size);
+    ipv4_hdr_t * sent = (ipv4_hdr_t *) icmp_pkt->data;
+    ipaddr_t sent_src, sent_dest;
+    ipaddr_from_buf(&sent_src, sent->src_ip);
+    ipaddr_from_buf(&sent_dest, sent->dest_ip);
+    //only trust errors about datagrams we could have sent
+    if (!ipv4_is_local(&sent_src))
+    {
+        return;
+    }
+    ipv4_pmtu_update(&sent_dest, x_ntohs(icmp_pkt->next_mtu), x_ntohs(sent->total_len));
+}
+
 net_err_t icmpv4_in(ipaddr_t * src_ip, ipaddr_t * netif_ip, pktbuf_t * buf)
 {
     debug_info(DEBUG_ICMP, "icmpv4 in");
@@ -82,6 +221,10 @@ net_err_t icmpv4_in(ipaddr_t * src_ip, ipaddr_t * netif_ip, pktbuf_t * buf)
     display_icmp_pkt("icmp in", icmp_pkt);
     switch (icmp_pkt->hdr.type) {
         case ICMPv4_ECHO_REQUEST:
+            if (!icmpv4_rate_ok(ICMPv4_ECHO_REPLY, src_ip))
+            {
+                return NET_ERR_FULL;
+            }
             err = pktbuf_remove_header(buf, iphdr_size);
             if (err < 0)
             {
@@ -91,6 +234,12 @@ net_err_t icmpv4_in(ipaddr_t * src_ip, ipaddr_t * netif_ip, pktbuf_t * buf)
             pktbuf_reset_access(buf);
 
             return icmpv4_echo_reply(src_ip, netif_ip, buf);
+        case ICMPv4_UNREACHABLE:
+            if (icmp_pkt->hdr.code == ICMPv4_UNREACHABLE_FRAG)
+            {
+                icmpv4_frag_needed(buf, iphdr_size);
+            }
+            //fall through - raw sockets still see it
         default:
             err = raw_in(buf);
             if (err < 0)
@@ -102,8 +251,17 @@ net_err_t icmpv4_in(ipaddr_t * src_ip, ipaddr_t * netif_ip, pktbuf_t * buf)
     }
 }
 
-net_err_t icmpv4_out_unreachable(ipaddr_t * dest_ip, ipaddr_t * src, uint8_t code, pktbuf_t * buf)
+/**
+ * output an error quoting the header and the start of the data of buf
+ */
+static net_err_t icmpv4_out_error(ipaddr_t * dest_ip, ipaddr_t * src, uint8_t type, uint8_t code, uint32_t reverse, pktbuf_t * buf)
 {
+    //check before any buffer is spent on it
+    if (!icmpv4_rate_ok(type, dest_ip))
+    {
+        return NET_ERR_FULL;
+    }
+
     int copy_size = ipv4_hdr_size((ipv4_pkt_t *) pktbuf_data(buf)) + 576;
     if (copy_size > buf->total_size)
     {
@@ -118,10 +276,10 @@ net_err_t icmpv4_out_unreachable(ipaddr_t * dest_ip, ipaddr_t * src, uint8_t cod
     }
 
     icmp_pkt_t * pkt = (icmp_pkt_t *) pktbuf_data(new_buf);
-    pkt->hdr.type = ICMPv4_UNREACHABLE;
+    pkt->hdr.type = type;
     pkt->hdr.code = code;
     pkt->hdr.checksum = 0;
-    pkt->reverse = 0;
+    pkt->reverse = reverse;
     pktbuf_reset_access(buf);
     pktbuf_seek(new_buf, sizeof(icmpv4_hdr_t) + 4);
     net_err_t err = pktbuf_copy(new_buf, buf, copy_size);
@@ -139,4 +297,20 @@ net_err_t icmpv4_out_unreachable(ipaddr_t * dest_ip, ipaddr_t * src, uint8_t cod
         return err;
     }
     return NET_ERR_OK; 
-}
\ No newline at end of file
+}
+
+net_err_t icmpv4_out_unreachable(ipaddr_t * dest_ip, ipaddr_t * src, uint8_t code, pktbuf_t * buf)
+{
+    return icmpv4_out_error(dest_ip, src, ICMPv4_UNREACHABLE, code, 0, buf);
+}
+
+net_err_t icmpv4_out_frag_needed(ipaddr_t * dest_ip, ipaddr_t * src, int mtu, pktbuf_t * buf)
+{
+    //next hop mtu goes in the low half of the unused word
+    return icmpv4_out_error(dest_ip, src, ICMPv4_UNREACHABLE, ICMPv4_UNREACHABLE_FRAG, x_htonl((uint32_t)mtu), buf);
+}
+
+net_err_t icmpv4_out_time_exceeded(ipaddr_t * dest_ip, ipaddr_t * src, pktbuf_t * buf)
+{
+    return icmpv4_out_error(dest_ip, src, ICMPv4_TIME_EXCEEDED, ICMPv4_TTL_EXCEEDED, 0, buf);
+}
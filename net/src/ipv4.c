@@ -12,17 +12,39 @@
 #include "raw.h"
 #include "udp.h"
 #include "tcp_in.h"
+#include "arp.h"
+#include "ether.h"
 
 static uint16_t packet_id = 0;
+//generation of cached destinations, 0 is never valid
+static uint32_t dst_gen = 1;
 static ip_frag_t frag_array[IP_FRAGS_MAX_NR];
 
 static mblock_t frag_mblock;
+//lru order, most recently used first
 static list_t frag_list;
+static ip_frag_t * frag_hash[IP_FRAG_HASH_SIZE];
+//bytes held by all datagrams being reassembled
+static int frag_mem;
 static net_timer_t frag_timer;
 
+static ip_pmtu_t pmtu_tbl[IP_PMTU_TBL_SIZE];
+static mblock_t pmtu_mblock;
+//lru order, most recently updated first
+static list_t pmtu_list;
+static net_timer_t pmtu_timer;
+
 static list_t rt_list;
 static rentry_t rt_table[IP_RTTABLE_SIZE];
 static mblock_t rt_block;
+//every route adds at most one leaf and one branch node
+static rt_trie_t rt_trie_tbl[IP_RTTABLE_SIZE * 2];
+static mblock_t rt_trie_block;
+static rt_trie_t * rt_root;
+
+//loopback fast path, only touched by the work thread
+static ip_local_t local_q[IP_LOCAL_QUEUE_SIZE];
+static int local_q_in, local_q_out, local_q_cnt;
 
 #if DEBUG_DISP_ENABLED(DEBUG_IP)
 void rt_list_display()
@@ -108,6 +130,28 @@ static void display_ip_frags()
 #define display_ip_frags()
 #endif
 
+static ip_frag_t ** frag_bucket(ipaddr_t * src, ipaddr_t * dest, uint8_t protocol, uint16_t id)
+{
+    uint32_t hash = src->q_addr ^ (dest->q_addr * 31) ^ ((uint32_t)protocol << 16) ^ id;
+    hash *= 0x9E3779B1;
+    return frag_hash + ((hash >> 16) % IP_FRAG_HASH_SIZE);
+}
+
+static void frag_hash_remove(ip_frag_t * frag)
+{
+    ip_frag_t ** pre = frag_bucket(&frag->ip, &frag->dest, frag->protocol, frag->id);
+    while (*pre)
+    {
+        if (*pre == frag)
+        {
+            *pre = frag->hash_next;
+            break;
+        }
+        pre = &(*pre)->hash_next;
+    }
+    frag->hash_next = (ip_frag_t *)0;
+}
+
 static void frag_free_buf_list(ip_frag_t * frag)
 {
     node_t * node;
@@ -116,11 +160,14 @@ static void frag_free_buf_list(ip_frag_t * frag)
         pktbuf_t * buf = list_node_parent(node, pktbuf_t, node);
         pktbuf_free(buf);
     }
+    frag_mem -= frag->mem;
+    frag->mem = 0;
 }
 
 static void frag_free(ip_frag_t * frag)
 {
     frag_free_buf_list(frag);
+    frag_hash_remove(frag);
     list_remove(&frag_list, &frag->node);
     mblock_free(&frag_mblock, frag);
 }
@@ -145,6 +192,8 @@ static void frag_tmo(struct net_timer_t * timer, void * arg)
 static net_err_t frag_init()
 {
     list_init(&frag_list);
+    plat_memset(frag_hash, 0, sizeof(frag_hash));
+    frag_mem = 0;
     net_err_t err = mblock_init(&frag_mblock, frag_array, sizeof(ip_frag_t), IP_FRAGS_MAX_NR, LOCKER_NONE);
     if (err < 0)
     {
@@ -161,6 +210,123 @@ static net_err_t frag_init()
     return NET_ERR_OK;
 }
 
+static ip_pmtu_t * pmtu_find(ipaddr_t * dest)
+{
+    node_t * node;
+    list_for_each(node, &pmtu_list)
+    {
+        ip_pmtu_t * pmtu = list_node_parent(node, ip_pmtu_t, node);
+        if (ipaddr_is_equal(&pmtu->dest, dest))
+        {
+            return pmtu;
+        }
+    }
+    return (ip_pmtu_t *)0;
+}
+
+/**
+ * forget expired path mtus, the next packets go out at the interface mtu again
+ */
+static void pmtu_tmo(struct net_timer_t * timer, void * arg)
+{
+    int expired = 0;
+    node_t * curr, * next;
+    for (curr = list_first(&pmtu_list); curr; curr = next)
+    {
+        next = list_node_next(curr);
+        ip_pmtu_t * pmtu = list_node_parent(curr, ip_pmtu_t, node);
+        if (--pmtu->tmo <= 0)
+        {
+            list_remove(&pmtu_list, curr);
+            mblock_free(&pmtu_mblock, pmtu);
+            expired = 1;
+        }
+    }
+    if (expired)
+    {
+        ipv4_dst_invalidate();
+    }
+}
+
+static net_err_t pmtu_init()
+{
+    list_init(&pmtu_list);
+    net_err_t err = mblock_init(&pmtu_mblock, pmtu_tbl, sizeof(ip_pmtu_t), IP_PMTU_TBL_SIZE, LOCKER_NONE);
+    if (err < 0)
+    {
+        debug_error(DEBUG_IP, "mblock init failed");
+        return err;
+    }
+
+    err = net_timer_add(&pmtu_timer, "pmtu-timer", pmtu_tmo, (void *)0, IP_PMTU_SCAN_PERIOD * 1000, NET_TIMER_RELOAD);
+    if (err < 0)
+    {
+        debug_error(DEBUG_IP, "create pmtu timer failed");
+        return err;
+    }
+    return NET_ERR_OK;
+}
+
+/**
+ * rfc 1191 plateau below a datagram of size, for routers not reporting their mtu
+ */
+static int pmtu_plateau(int size)
+{
+    static const int plateau[] = {32000, 17914, 8166, 4352, 2002, 1492, 1006, 508, 296, IP_PMTU_MIN};
+    for (int i = 0; i < sizeof(plateau) / sizeof(plateau[0]); i++)
+    {
+        if (plateau[i] < size)
+        {
+            return plateau[i];
+        }
+    }
+    return IP_PMTU_MIN;
+}
+
+void ipv4_pmtu_update(ipaddr_t * dest, int mtu, int sent_size)
+{
+    if (!mtu || (mtu >= sent_size))
+    {
+        mtu = pmtu_plateau(sent_size);
+    }
+    if (mtu < IP_PMTU_MIN)
+    {
+        mtu = IP_PMTU_MIN;
+    }
+
+    rentry_t * rt = rt_find(dest);
+    if (!rt || (rt->netif->mtu && (mtu >= rt->netif->mtu)))
+    {
+        return;
+    }
+
+    ip_pmtu_t * pmtu = pmtu_find(dest);
+    if (pmtu)
+    {
+        //only ever lower it, raising waits for the entry to expire
+        if (mtu >= pmtu->mtu)
+        {
+            return;
+        }
+        list_remove(&pmtu_list, &pmtu->node);
+    }
+    else
+    {
+        pmtu = mblock_alloc(&pmtu_mblock, -1);
+        if (!pmtu)
+        {
+            node_t * node = list_remove_last(&pmtu_list);
+            pmtu = list_node_parent(node, ip_pmtu_t, node);
+        }
+        ipaddr_copy(&pmtu->dest, dest);
+    }
+    pmtu->mtu = mtu;
+    pmtu->tmo = IP_PMTU_TMO / IP_PMTU_SCAN_PERIOD;
+    list_insert_first(&pmtu_list, &pmtu->node);
+    debug_info(DEBUG_IP, "path mtu lowered to %d", mtu);
+    ipv4_dst_invalidate();
+}
+
 /**
  * init the route table
  */
@@ -168,6 +334,8 @@ static void rt_init()
 {
     list_init(&rt_list);
     mblock_init(&rt_block, rt_table, sizeof(rentry_t), IP_RTTABLE_SIZE, LOCKER_NONE);
+    mblock_init(&rt_trie_block, rt_trie_tbl, sizeof(rt_trie_t), IP_RTTABLE_SIZE * 2, LOCKER_NONE);
+    rt_root = (rt_trie_t *)0;
 }
 
 net_err_t ipv4_init()
@@ -180,43 +348,71 @@ net_err_t ipv4_init()
         debug_error(DEBUG_IP, "frag init failed");
         return err;
     }
+    err = pmtu_init();
+    if (err < 0)
+    {
+        debug_error(DEBUG_IP, "pmtu init failed");
+        return err;
+    }
     rt_init();
     return NET_ERR_OK;
 }
 
-//alloc frag
+//alloc frag, reusing the least recently used one if all are taken
 static ip_frag_t * frag_alloc()
 {
     ip_frag_t * frag = mblock_alloc(&frag_mblock, -1);
     if (!frag)
     {
-        node_t * node = list_remove_last(&frag_list);
-        frag = list_node_parent(node, ip_frag_t, node);
-        if (frag)
+        node_t * node = list_last(&frag_list);
+        if (!node)
         {
-            frag_free_buf_list(frag);
+            return (ip_frag_t *)0;
         }
+        frag_free(list_node_parent(node, ip_frag_t, node));
+        frag = mblock_alloc(&frag_mblock, -1);
     }
     return frag;
 }
 
-static ip_frag_t * frag_find(ipaddr_t * ip, uint16_t id)
+static ip_frag_t * frag_find(ipaddr_t * src, ipaddr_t * dest, uint8_t protocol, uint16_t id)
 {
-    node_t * curr;
-
-    list_for_each(curr, &frag_list)
+    for (ip_frag_t * frag = *frag_bucket(src, dest, protocol, id); frag; frag = frag->hash_next)
     {
-        ip_frag_t * frag = list_node_parent(curr, ip_frag_t, node);
-        if (ipaddr_is_equal(ip, &frag->ip) && (id == frag->id))
+        if ((id == frag->id) && (protocol == frag->protocol)
+            && ipaddr_is_equal(src, &frag->ip) && ipaddr_is_equal(dest, &frag->dest))
         {
-            list_remove(&frag_list, curr);
-            list_insert_first(&frag_list, curr);
+            if (list_first(&frag_list) != &frag->node)
+            {
+                list_remove(&frag_list, &frag->node);
+                list_insert_first(&frag_list, &frag->node);
+            }
             return frag;
         }
     }
     return (ip_frag_t *) 0;
 }
 
+/**
+ * make room for size more bytes within IP_FRAG_MEM_MAX, dropping the oldest datagrams except keep
+ * @return 1 if it fits
+ */
+static int frag_reserve(int size, ip_frag_t * keep)
+{
+    while (frag_mem + size > IP_FRAG_MEM_MAX)
+    {
+        node_t * node = list_last(&frag_list);
+        ip_frag_t * frag = node ? list_node_parent(node, ip_frag_t, node) : (ip_frag_t *)0;
+        if (!frag || (frag == keep))
+        {
+            return 0;
+        }
+        debug_warn(DEBUG_IP, "frag memory full, drop id %d", frag->id);
+        frag_free(frag);
+    }
+    return 1;
+}
+
 static net_err_t is_pkt_ok(ipv4_pkt_t * pkt, int size, netif_t * netif)
 {
     if (pkt->hdr.version != NET_VERSION_IPV4)
@@ -264,14 +460,22 @@ static void iphdr_htons(ipv4_pkt_t * pkt)
     pkt->hdr.frag_all = x_htons(pkt->hdr.frag_all);
 }
 
-static void frag_add(ip_frag_t * frag, ipaddr_t * ip, uint16_t id)
+static void frag_add(ip_frag_t * frag, ipaddr_t * src, ipaddr_t * dest, uint8_t protocol, uint16_t id)
 {
-    ipaddr_copy(&frag->ip, ip);
+    ipaddr_copy(&frag->ip, src);
+    ipaddr_copy(&frag->dest, dest);
+    frag->protocol = protocol;
     frag->tmo = IP_FRAG_TMO / IP_FRAG_SCAN_PERIOD;
     frag->id = id;
+    frag->recv_size = frag->mem = 0;
+    frag->total_size = -1;
     node_init(&frag->node);
     list_init(&frag->buf_list);
     list_insert_first(&frag_list, &frag->node);
+
+    ip_frag_t ** bucket = frag_bucket(src, dest, protocol, id);
+    frag->hash_next = *bucket;
+    *bucket = frag;
 }
 
 static net_err_t frag_insert(ip_frag_t * frag, pktbuf_t * buf, ipv4_pkt_t * pkt)
@@ -282,18 +486,44 @@ static net_err_t frag_insert(ip_frag_t * frag, pktbuf_t * buf, ipv4_pkt_t * pkt)
         frag_free(frag);
         return NET_ERR_FULL;
     }
-    node_t * node;
-    list_for_each(node, &frag->buf_list)
+
+    int start = get_frag_start(pkt);
+    int end = get_frag_end(pkt);
+    if (!pkt->hdr.more)
     {
-        pktbuf_t * curr_buf = list_node_parent(node, pktbuf_t, node);
-        ipv4_pkt_t * curr_pkt = (ipv4_pkt_t *) pktbuf_data(curr_buf);
-        uint16_t curr_start = get_frag_start(curr_pkt);
-        if (get_frag_start(pkt) == curr_start)
+        if ((frag->total_size >= 0) && (frag->total_size != end))
         {
             return NET_ERR_EXIST;
         }
-        else if(get_frag_end(pkt) <= curr_start)
+        frag->total_size = end;
+    }
+    else if ((frag->total_size >= 0) && (end > frag->total_size))
+    {
+        return NET_ERR_SIZE;
+    }
+
+    //fragments mostly come in order, so try the tail first
+    node_t * node = list_last(&frag->buf_list);
+    pktbuf_t * last = node ? list_node_parent(node, pktbuf_t, node) : (pktbuf_t *)0;
+    if (!last || (get_frag_end((ipv4_pkt_t *) pktbuf_data(last)) <= start))
+    {
+        list_insert_last(&frag->buf_list, &buf->node);
+    }
+    else
+    {
+        list_for_each(node, &frag->buf_list)
         {
+            pktbuf_t * curr_buf = list_node_parent(node, pktbuf_t, node);
+            ipv4_pkt_t * curr_pkt = (ipv4_pkt_t *) pktbuf_data(curr_buf);
+            if (get_frag_end(curr_pkt) <= start)
+            {
+                continue;
+            }
+            //duplicated or overlapping data is dropped, so recv_size counts every byte once
+            if (end > get_frag_start(curr_pkt))
+            {
+                return NET_ERR_EXIST;
+            }
             node_t * pre = list_node_pre(node);
             if (pre)
             {
@@ -303,36 +533,22 @@ static net_err_t frag_insert(ip_frag_t * frag, pktbuf_t * buf, ipv4_pkt_t * pkt)
             {
                 list_insert_first(&frag->buf_list, &buf->node);
             }
-            return NET_ERR_OK;
+            break;
         }
     }
-    list_insert_last(&frag->buf_list, &buf->node);
+
+    frag->recv_size += end - start;
+    frag->mem += buf->total_size;
+    frag_mem += buf->total_size;
     return NET_ERR_OK;
 }
 
 /**
- * Determine whether all fragments have arrived
+ * all data arrived once the bytes received add up to the size given by the last fragment
  */
 static int frag_is_all_arrived(ip_frag_t * frag)
 {
-    int offset = 0;
-    node_t * node;
-    ipv4_pkt_t * pkt = (ipv4_pkt_t *)0;
-    list_for_each(node, &frag->buf_list)
-    {
-        pktbuf_t * buf = list_node_parent(node, pktbuf_t, node);
-        pkt = (ipv4_pkt_t *) pktbuf_data(buf);
-
-        int curr_offset = get_frag_start(pkt);
-        if (curr_offset != offset)
-        {
-            return 0;
-        }
-
-        offset += get_data_size(pkt);
-    }
-
-    return pkt ? !pkt->hdr.more : 0;
+    return (frag->total_size >= 0) && (frag->recv_size == frag->total_size);
 }
 
 /**
@@ -379,15 +595,26 @@ static pktbuf_t * frag_merge(ip_frag_t * frag)
 }
 
 static net_err_t ip_normal_in(netif_t * netif, pktbuf_t * buf, ipaddr_t * src_ip, ipaddr_t * dest_ip);
+static net_err_t ip_forward(netif_t * netif, rentry_t * rt, pktbuf_t * buf, ipaddr_t * src_ip, ipaddr_t * dest_ip);
 
 static net_err_t ip_frag_in(netif_t * netif, pktbuf_t * buf, ipaddr_t * src_ip, ipaddr_t * dest_ip)
 {
     ipv4_pkt_t * curr = (ipv4_pkt_t *) pktbuf_data(buf);
-    ip_frag_t * frag = frag_find(src_ip, curr->hdr.id);
+    ip_frag_t * frag = frag_find(src_ip, dest_ip, curr->hdr.protocol, curr->hdr.id);
+    if (!frag_reserve(buf->total_size, frag))
+    {
+        debug_warn(DEBUG_IP, "frag memory full");
+        return NET_ERR_FULL;
+    }
     if (!frag)
     {
         frag = frag_alloc();
-        frag_add(frag, src_ip, curr->hdr.id);
+        if (!frag)
+        {
+            debug_warn(DEBUG_IP, "alloc frag failed");
+            return NET_ERR_MEM;
+        }
+        frag_add(frag, src_ip, dest_ip, curr->hdr.protocol, curr->hdr.id);
     }
     net_err_t err = frag_insert(frag, buf, curr);
     if (err < 0)
@@ -441,7 +668,7 @@ static net_err_t ip_normal_in(netif_t * netif, pktbuf_t * buf, ipaddr_t * src_ip
                 if (err == NET_ERR_UNREACHABLE)
                 {
                     iphdr_htons(pkt);
-                    icmpv4_out_unreachable(dest_ip, &netif->ipaddr, ICMPv4_UNREACHABLE_PORT, buf);
+                    icmpv4_out_unreachable(src_ip, &netif->ipaddr, ICMPv4_UNREACHABLE_PORT, buf);
                 }
                 return err;
             }
@@ -500,8 +727,18 @@ net_err_t ipv4_in(netif_t * netif, pktbuf_t * buf)
 
     if (!ipaddr_is_match(&dest_ip, &netif->ipaddr, &netif->netmask))
     {
-        debug_warn(DEBUG_IP, "ipaddr not match");
-        return NET_ERR_UNREACHABLE;
+        if (!netif->forward)
+        {
+            debug_warn(DEBUG_IP, "ipaddr not match");
+            return NET_ERR_UNREACHABLE;
+        }
+
+        //a router takes packets for the addresses of its other netifs too
+        rentry_t * rt = rt_find(&dest_ip);
+        if (!rt || (rt->netif->type == NETIF_TYPE_LOOP) || !ipaddr_is_equal(&dest_ip, &rt->netif->ipaddr))
+        {
+            return ip_forward(netif, rt, buf, &src_ip, &dest_ip);
+        }
     }
     if (pkt->hdr.frag_offset || pkt->hdr.more)
     {
@@ -511,63 +748,53 @@ net_err_t ipv4_in(netif_t * netif, pktbuf_t * buf)
     {
         err = ip_normal_in(netif, buf, &src_ip, &dest_ip);
     }
-    return NET_ERR_OK;
+    //buf was not taken, the caller frees it
+    return err;
 }
 
-net_err_t ip_frag_out(uint8_t protocol, ipaddr_t * dest, ipaddr_t * src, pktbuf_t * buf, ipaddr_t * next_hop, netif_t * netif)
+/**
+ * send buf as fragments of at most mtu bytes, each behind a copy of hdr (host order)
+ */
+static net_err_t ip_frag_send(ipv4_hdr_t * hdr, pktbuf_t * buf, ipaddr_t * next_hop, netif_t * netif, int mtu)
 {
-    debug_info(DEBUG_IP, "frag send ip pkt");
     pktbuf_reset_access(buf);
 
-    int offset = 0;
+    //a forwarded fragment is cut further from its own offset
+    int offset = hdr->frag_offset * 8;
     int total = buf->total_size;
 
     while (total)
     {
         int curr_size = total;
-        if (curr_size + sizeof(ipv4_hdr_t)> netif->mtu)
+        if (curr_size + sizeof(ipv4_hdr_t)> mtu)
         {
-            curr_size = (int)(netif->mtu - sizeof(ipv4_hdr_t));
+            //offsets are in 8 byte units, so all but the last fragment must be aligned
+            curr_size = (int)(mtu - sizeof(ipv4_hdr_t)) & ~7;
         }
 
-        pktbuf_t * dest_buf = pktbuf_alloc((int) (curr_size + sizeof(ipv4_hdr_t)));
+        //move the payload blocks over instead of copying them, then chain a header block in front
+        pktbuf_t * dest_buf = pktbuf_split(buf, curr_size);
         if (!dest_buf)
         {
             debug_error(DEBUG_IP, "alloc buf failed");
             return NET_ERR_NONE;
         }
-        ipv4_pkt_t * pkt = (ipv4_pkt_t *) pktbuf_data(dest_buf);
-        pkt->hdr.shdr_all = 0;
-        pkt->hdr.version = NET_VERSION_IPV4;
-        ipv4_set_hdr_size(pkt, sizeof(ipv4_hdr_t));
-        pkt->hdr.total_len = dest_buf->total_size;
-        pkt->hdr.id = packet_id;
-        pkt->hdr.frag_all = 0;
-        pkt->hdr.ttl = NET_IP_DEFAULT_TTL;
-        pkt->hdr.protocol = protocol;
-        pkt->hdr.header_checksum = 0;
-        if (!src || ipaddr_is_any(src))
-        {
-            ipaddr_to_buf(&netif->ipaddr, pkt->hdr.src_ip);
-        }
-        else
-        {
-            ipaddr_to_buf(src, pkt->hdr.src_ip);
-        }
-        ipaddr_to_buf(dest, pkt->hdr.dest_ip);
-        pkt->hdr.frag_offset = offset >> 3;
-        pkt->hdr.more = total > curr_size;
-        pktbuf_seek(dest_buf, sizeof(ipv4_hdr_t));
-        net_err_t err = pktbuf_copy(dest_buf, buf, curr_size);
+        net_err_t err = pktbuf_add_header(dest_buf, sizeof(ipv4_hdr_t), 1);
         if (err < 0)
         {
-            debug_error(DEBUG_IP, "frag buf copy failed");
+            debug_error(DEBUG_IP, "add frag header failed");
             pktbuf_free(dest_buf);
             return err;
         }
-
-        pktbuf_remove_header(buf, curr_size);
-        pktbuf_reset_access(buf);
+        //keep all fragments on one netif queue
+        dest_buf->flow_hash = buf->flow_hash;
+        ipv4_pkt_t * pkt = (ipv4_pkt_t *) pktbuf_data(dest_buf);
+        pkt->hdr = *hdr;
+        ipv4_set_hdr_size(pkt, sizeof(ipv4_hdr_t));
+        pkt->hdr.total_len = dest_buf->total_size;
+        pkt->hdr.header_checksum = 0;
+        pkt->hdr.frag_offset = offset >> 3;
+        pkt->hdr.more = (total > curr_size) || hdr->more;
 
         iphdr_htons(pkt);
         pktbuf_reset_access(dest_buf);
@@ -585,37 +812,259 @@ net_err_t ip_frag_out(uint8_t protocol, ipaddr_t * dest, ipaddr_t * src, pktbuf_
         total -= curr_size;
         offset += curr_size;
     }
-    packet_id++;
     pktbuf_free(buf);
     return NET_ERR_OK;
 }
 
+net_err_t ip_frag_out(uint8_t protocol, ipaddr_t * dest, ipaddr_t * src, pktbuf_t * buf, ipaddr_t * next_hop, netif_t * netif, int mtu)
+{
+    debug_info(DEBUG_IP, "frag send ip pkt");
 
-net_err_t ipv4_out(uint8_t protocol, ipaddr_t * dest, ipaddr_t * src, pktbuf_t * buf)
+    ipv4_hdr_t hdr;
+    hdr.shdr_all = 0;
+    hdr.version = NET_VERSION_IPV4;
+    hdr.id = packet_id++;
+    hdr.frag_all = 0;
+    hdr.ttl = NET_IP_DEFAULT_TTL;
+    hdr.protocol = protocol;
+    if (!src || ipaddr_is_any(src))
+    {
+        ipaddr_to_buf(&netif->ipaddr, hdr.src_ip);
+    }
+    else
+    {
+        ipaddr_to_buf(src, hdr.src_ip);
+    }
+    ipaddr_to_buf(dest, hdr.dest_ip);
+    return ip_frag_send(&hdr, buf, next_hop, netif, mtu);
+}
+
+/**
+ * route a packet for another host out of the netif of rt, buf is handed on as it is.
+ * ip header is in host order, on error the caller frees buf
+ */
+static net_err_t ip_forward(netif_t * netif, rentry_t * rt, pktbuf_t * buf, ipaddr_t * src_ip, ipaddr_t * dest_ip)
 {
-    debug_info(DEBUG_IP, "send ip packet");
+    ipv4_pkt_t * pkt = (ipv4_pkt_t *) pktbuf_data(buf);
+    netif->fwd_stats.in++;
 
-    rentry_t * rt = rt_find(dest);
-    if (!rt)
+    //never route to loopback or multicast
+    if (!rt || (rt->netif->type == NETIF_TYPE_LOOP) || (dest_ip->addr[0] >= 224))
     {
-        debug_error(DEBUG_IP, "send failed, no route");
+        debug_warn(DEBUG_IP, "forward: no route");
+        netif->fwd_stats.no_route++;
+        if (!rt)
+        {
+            iphdr_htons(pkt);
+            icmpv4_out_unreachable(src_ip, &netif->ipaddr, ICMPv4_UNREACHABLE_NET, buf);
+        }
+        return NET_ERR_UNREACHABLE;
+    }
+
+    if (pkt->hdr.ttl <= 1)
+    {
+        debug_warn(DEBUG_IP, "forward: ttl exceeded");
+        netif->fwd_stats.ttl_exceeded++;
+        iphdr_htons(pkt);
+        icmpv4_out_time_exceeded(src_ip, &netif->ipaddr, buf);
         return NET_ERR_UNREACHABLE;
     }
+
+    netif_t * out = rt->netif;
     ipaddr_t next_hop;
-    if (ipaddr_is_any(&rt->next_hop))
+    ipaddr_copy(&next_hop, ipaddr_is_any(&rt->next_hop) ? dest_ip : &rt->next_hop);
+
+    //merged by gro: let gso cut it for the output netif
+    if (buf->gro)
     {
-        ipaddr_copy(&next_hop, dest);
+        buf->gso_size = out->mtu ? (int)(out->mtu - sizeof(ipv4_hdr_t) - sizeof(tcp_hdr_t)) : 0;
+    }
+
+    //ttl and protocol share a word, update the checksum for it alone
+    uint16_t * ttl_word = (uint16_t *) &pkt->hdr.ttl;
+    uint16_t old_word = *ttl_word;
+    pkt->hdr.ttl--;
+    pkt->hdr.header_checksum = checksum16_update(pkt->hdr.header_checksum, old_word, *ttl_word);
+
+    net_err_t err;
+    if (!buf->gso_size && out->mtu && (pkt->hdr.total_len > out->mtu))
+    {
+        if (pkt->hdr.disable)
+        {
+            debug_warn(DEBUG_IP, "forward: too big with DF");
+            netif->fwd_stats.frag_needed++;
+            iphdr_htons(pkt);
+            icmpv4_out_frag_needed(src_ip, &netif->ipaddr, out->mtu, buf);
+            return NET_ERR_SIZE;
+        }
+
+        //fragments go without options
+        ipv4_hdr_t hdr = pkt->hdr;
+        err = pktbuf_remove_header(buf, ipv4_hdr_size(pkt));
+        if (err >= 0)
+        {
+            err = ip_frag_send(&hdr, buf, &next_hop, out, out->mtu);
+        }
+        if (err >= 0)
+        {
+            netif->fwd_stats.fragmented++;
+        }
     }
     else
     {
-        ipaddr_copy(&next_hop, &rt->next_hop);
+        iphdr_htons(pkt);
+        buf->csum_valid = 0;
+        err = netif_out(out, &next_hop, buf);
+    }
+    if (err < 0)
+    {
+        debug_warn(DEBUG_IP, "forward: send failed");
+        netif->fwd_stats.out_err++;
+        return err;
+    }
+    out->fwd_stats.out++;
+    return NET_ERR_OK;
+}
+
+
+int ipv4_is_local(ipaddr_t * ip)
+{
+    rentry_t * rt = rt_find(ip);
+    return rt && rt->local;
+}
+
+/**
+ * queue packet for ipv4_local_poll instead of going through netif queues,
+ * so no checksum has to be generated or verified
+ */
+static net_err_t ip_local_out(netif_t * netif, pktbuf_t * buf)
+{
+    if (local_q_cnt >= IP_LOCAL_QUEUE_SIZE)
+    {
+        return NET_ERR_FULL;
     }
 
-    netif_t * netif = rt->netif;
+    ip_local_t * local = local_q + local_q_in;
+    local->netif = netif;
+    local->buf = buf;
+    if (++local_q_in >= IP_LOCAL_QUEUE_SIZE)
+    {
+        local_q_in = 0;
+    }
+    local_q_cnt++;
+    buf->csum_valid = 1;
+    return NET_ERR_OK;
+}
 
-    if (netif->mtu && ((buf->total_size + sizeof(ipv4_hdr_t)) > netif->mtu))
+void ipv4_local_poll(void)
+{
+    while (local_q_cnt > 0)
     {
-        net_err_t err = ip_frag_out(protocol, dest, src, buf, &next_hop, netif);
+        ip_local_t local = local_q[local_q_out];
+        if (++local_q_out >= IP_LOCAL_QUEUE_SIZE)
+        {
+            local_q_out = 0;
+        }
+        local_q_cnt--;
+
+        pktbuf_reset_access(local.buf);
+        net_err_t err = ipv4_in(local.netif, local.buf);
+        if (err < 0)
+        {
+            debug_warn(DEBUG_IP, "local in failed, err = %d", err);
+            pktbuf_free(local.buf);
+        }
+    }
+}
+
+void ipv4_dst_invalidate(void)
+{
+    if (++dst_gen == 0)
+    {
+        dst_gen = 1;
+    }
+}
+
+net_err_t ipv4_dst_update(ip_dst_t * dst, ipaddr_t * dest)
+{
+    if ((dst->gen == dst_gen) && ipaddr_is_equal(&dst->dest, dest))
+    {
+        return NET_ERR_OK;
+    }
+
+    rentry_t * rt = rt_find(dest);
+    if (!rt)
+    {
+        dst->gen = 0;
+        return NET_ERR_UNREACHABLE;
+    }
+    ipaddr_copy(&dst->dest, dest);
+    dst->netif = rt->netif;
+    ipaddr_copy(&dst->next_hop, ipaddr_is_any(&rt->next_hop) ? dest : &rt->next_hop);
+    dst->local = rt->local;
+    dst->mtu = rt->netif->mtu;
+    ip_pmtu_t * pmtu = dst->local ? (ip_pmtu_t *)0 : pmtu_find(dest);
+    if (pmtu && (!dst->mtu || (pmtu->mtu < dst->mtu)))
+    {
+        dst->mtu = pmtu->mtu;
+    }
+    dst->hdr_len = 0;
+    dst->gen = dst_gen;
+    return NET_ERR_OK;
+}
+
+/**
+ * prebuild the link header once the next hop is resolved
+ */
+static void dst_build_hdr(ip_dst_t * dst)
+{
+    netif_t * netif = dst->netif;
+    if (dst->local || (netif->type != NETIF_TYPE_ETHER))
+    {
+        return;
+    }
+
+    const uint8_t * hwaddr = arp_find(netif, &dst->next_hop);
+    //frames to our own hwaddr are looped back by ether_raw_out
+    if (hwaddr && plat_memcmp(hwaddr, netif->hwaddr.addr, ETHER_HWA_SIZE))
+    {
+        dst->hdr_len = ether_hdr_build(netif, NET_PROTOCOL_IPV4, hwaddr, dst->hdr);
+    }
+}
+
+net_err_t ipv4_out(uint8_t protocol, ipaddr_t * dest, ipaddr_t * src, pktbuf_t * buf)
+{
+    return ipv4_out_dst(protocol, dest, src, buf, (ip_dst_t *)0);
+}
+
+net_err_t ipv4_out_dst(uint8_t protocol, ipaddr_t * dest, ipaddr_t * src, pktbuf_t * buf, ip_dst_t * dst)
+{
+    debug_info(DEBUG_IP, "send ip packet");
+    buf->csum_valid = 0;
+
+    //without a socket cache, look the route up for this packet only
+    ip_dst_t route;
+    int cached = dst != (ip_dst_t *)0;
+    if (!cached)
+    {
+        dst = &route;
+        dst->gen = 0;
+        dst->df = 0;
+    }
+    if (ipv4_dst_update(dst, dest) < 0)
+    {
+        debug_error(DEBUG_IP, "send failed, no route");
+        return NET_ERR_UNREACHABLE;
+    }
+
+    ipaddr_t next_hop;
+    ipaddr_copy(&next_hop, &dst->next_hop);
+    netif_t * netif = dst->netif;
+    int local = dst->local;
+
+    if (!local && !buf->gso_size && dst->mtu && ((buf->total_size + sizeof(ipv4_hdr_t)) > dst->mtu))
+    {
+        net_err_t err = ip_frag_out(protocol, dest, src, buf, &next_hop, netif, dst->mtu);
         if (err < 0)
         {
             debug_warn(DEBUG_IP, "send ip frag failed");
@@ -637,7 +1086,13 @@ net_err_t ipv4_out(uint8_t protocol, ipaddr_t * dest, ipaddr_t * src, pktbuf_t *
     ipv4_set_hdr_size(pkt, sizeof(ipv4_hdr_t));
     pkt->hdr.total_len = buf->total_size;
     pkt->hdr.id = packet_id++;
+    if (buf->gso_segs > 1)
+    {
+        //each segment cut by gso takes the next id
+        packet_id += buf->gso_segs - 1;
+    }
     pkt->hdr.frag_all = 0;
+    pkt->hdr.disable = dst->df;
     pkt->hdr.ttl = NET_IP_DEFAULT_TTL;
     pkt->hdr.protocol = protocol;
     pkt->hdr.header_checksum = 0;
@@ -652,10 +1107,26 @@ net_err_t ipv4_out(uint8_t protocol, ipaddr_t * dest, ipaddr_t * src, pktbuf_t *
     ipaddr_to_buf(dest, pkt->hdr.dest_ip);
 
     iphdr_htons(pkt);
+    if (local && (ip_local_out(netif, buf) == NET_ERR_OK))
+    {
+        return NET_ERR_OK;
+    }
+
     pktbuf_reset_access(buf);
     pkt->hdr.header_checksum = pktbuf_checksum16(buf, ipv4_hdr_size(pkt), 0, 1);
     display_ip_pkt(pkt);
-    err = netif_out(netif, &next_hop, buf);
+    if (cached && !dst->hdr_len)
+    {
+        dst_build_hdr(dst);
+    }
+    if (dst->hdr_len)
+    {
+        err = ether_hdr_out(netif, dst->hdr, buf);
+    }
+    else
+    {
+        err = netif_out(netif, &next_hop, buf);
+    }
     if (err < 0)
     {
         debug_warn(DEBUG_IP, "send ip packet failed");
@@ -664,6 +1135,148 @@ net_err_t ipv4_out(uint8_t protocol, ipaddr_t * dest, ipaddr_t * src, pktbuf_t *
     return NET_ERR_OK;
 }
 
+static uint32_t rt_key(const ipaddr_t * ip)
+{
+    return ((uint32_t)ip->addr[0] << 24) | ((uint32_t)ip->addr[1] << 16)
+           | ((uint32_t)ip->addr[2] << 8) | ip->addr[3];
+}
+
+static uint32_t rt_mask(int len)
+{
+    return len ? (0xFFFFFFFF << (32 - len)) : 0;
+}
+
+static int rt_bit(uint32_t key, int pos)
+{
+    return (key >> (31 - pos)) & 1;
+}
+
+static rt_trie_t * rt_trie_alloc(uint32_t key, int len, rentry_t * entry)
+{
+    rt_trie_t * node = mblock_alloc(&rt_trie_block, -1);
+    if (node)
+    {
+        node->key = key & rt_mask(len);
+        node->len = len;
+        node->entry = entry;
+        node->child[0] = node->child[1] = (rt_trie_t *)0;
+    }
+    return node;
+}
+
+/**
+ * hang entry on the trie node of its prefix, creating the node if needed
+ */
+static net_err_t rt_trie_insert(rentry_t * entry)
+{
+    int len = entry->mask_1_cnt;
+    uint32_t key = rt_key(&entry->net) & rt_mask(len);
+
+    rt_trie_t ** link = &rt_root;
+    while (*link)
+    {
+        rt_trie_t * node = *link;
+        int max = len < node->len ? len : node->len;
+        int common = 0;
+        while ((common < max) && (rt_bit(key, common) == rt_bit(node->key, common)))
+        {
+            common++;
+        }
+
+        if (common == node->len)
+        {
+            if (node->len == len)
+            {
+                //same prefix, the first added one stays in use
+                rentry_t ** pre = &node->entry;
+                while (*pre)
+                {
+                    pre = &(*pre)->next;
+                }
+                *pre = entry;
+                return NET_ERR_OK;
+            }
+            link = &node->child[rt_bit(key, node->len)];
+            continue;
+        }
+
+        //the prefixes part at bit common, put a node there above node
+        rt_trie_t * split = rt_trie_alloc(key, common, (common == len) ? entry : (rentry_t *)0);
+        if (!split)
+        {
+            return NET_ERR_MEM;
+        }
+        split->child[rt_bit(node->key, common)] = node;
+        if (common < len)
+        {
+            rt_trie_t * leaf = rt_trie_alloc(key, len, entry);
+            if (!leaf)
+            {
+                mblock_free(&rt_trie_block, split);
+                return NET_ERR_MEM;
+            }
+            split->child[rt_bit(key, common)] = leaf;
+        }
+        *link = split;
+        return NET_ERR_OK;
+    }
+
+    *link = rt_trie_alloc(key, len, entry);
+    return *link ? NET_ERR_OK : NET_ERR_MEM;
+}
+
+/**
+ * take entry off the trie, dropping nodes no longer needed
+ */
+static void rt_trie_remove(rentry_t * entry)
+{
+    int len = entry->mask_1_cnt;
+    uint32_t key = rt_key(&entry->net) & rt_mask(len);
+
+    rt_trie_t ** parent_link = (rt_trie_t **)0;
+    rt_trie_t ** link = &rt_root;
+    while (*link && ((*link)->len < len))
+    {
+        parent_link = link;
+        link = &(*link)->child[rt_bit(key, (*link)->len)];
+    }
+
+    rt_trie_t * node = *link;
+    if (!node || (node->len != len) || (node->key != key))
+    {
+        return;
+    }
+
+    rentry_t ** pre = &node->entry;
+    while (*pre && (*pre != entry))
+    {
+        pre = &(*pre)->next;
+    }
+    if (*pre)
+    {
+        *pre = entry->next;
+    }
+    entry->next = (rentry_t *)0;
+    if (node->entry || (node->child[0] && node->child[1]))
+    {
+        return;
+    }
+
+    //a node without route is only kept to join two subtrees
+    *link = node->child[0] ? node->child[0] : node->child[1];
+    mblock_free(&rt_trie_block, node);
+
+    if (parent_link)
+    {
+        rt_trie_t * parent = *parent_link;
+        if (!parent->entry && !(parent->child[0] && parent->child[1]))
+        {
+            *parent_link = parent->child[0] ? parent->child[0] : parent->child[1];
+            mblock_free(&rt_trie_block, parent);
+        }
+    }
+}
+
 void rt_add(ipaddr_t * net, ipaddr_t * mask, ipaddr_t * next_hop, netif_t * netif)
 {
     rentry_t * entry = mblock_alloc(&rt_block, -1);
@@ -678,7 +1291,17 @@ void rt_add(ipaddr_t * net, ipaddr_t * mask, ipaddr_t * next_hop, netif_t * neti
     ipaddr_copy(&entry->next_hop, next_hop);
     entry->netif = netif;
     entry->mask_1_cnt = ipaddr_1_cnt(mask);
+    entry->local = (netif->type == NETIF_TYPE_LOOP)
+        || ((entry->mask_1_cnt == 32) && ipaddr_is_equal(net, &netif->ipaddr));
+    entry->next = (rentry_t *)0;
+    if (rt_trie_insert(entry) < 0)
+    {
+        debug_warn(DEBUG_IP, "alloc rt trie node failed");
+        mblock_free(&rt_block, entry);
+        return;
+    }
     list_insert_last(&rt_list, &entry->node);
+    ipv4_dst_invalidate();
     rt_list_display();
 }
 
@@ -691,6 +1314,9 @@ void rt_remove(ipaddr_t * net, ipaddr_t * mask)
         if (ipaddr_is_equal(&entry->net, net) && ipaddr_is_equal(&entry->mask, mask))
         {
             list_remove(&rt_list, node);
+            rt_trie_remove(entry);
+            mblock_free(&rt_block, entry);
+            ipv4_dst_invalidate();
             return;
         }
     }
@@ -699,20 +1325,22 @@ void rt_remove(ipaddr_t * net, ipaddr_t * mask)
 
 rentry_t * rt_find(ipaddr_t * ip)
 {
+    uint32_t key = rt_key(ip);
     rentry_t * e = (rentry_t *)0;
-    node_t * node;
-    list_for_each(node, &rt_list)
+
+    //at most 33 nodes on any path, however many routes there are
+    rt_trie_t * node = rt_root;
+    while (node && (((key ^ node->key) & rt_mask(node->len)) == 0))
     {
-        rentry_t * entry = list_node_parent(node, rentry_t, node);
-        ipaddr_t net = ipaddr_get_net(ip, &entry->mask);
-        if (!ipaddr_is_equal(&net, &entry->net))
+        if (node->entry)
         {
-            continue;
+            e = node->entry;
         }
-        if (!e || (e->mask_1_cnt < entry->mask_1_cnt))
+        if (node->len == 32)
         {
-            e = entry;
+            break;
         }
+        node = node->child[rt_bit(key, node->len)];
     }
     return e;
 }
\ No newline at end of file
@@ -17,16 +17,19 @@ void loop_close(struct netif_t * netif)
 
 net_err_t loop_xmit(struct netif_t * netif)
 {
-    //get data packet from out_q
-    pktbuf_t * pktbuf = netif_get_out(netif, -1);
-    if (pktbuf)
+    for (int i = 0; i < netif->queue_cnt; i++)
     {
-        //put data packet into in_q
-        net_err_t err = netif_put_in(netif, pktbuf, -1);
-        if (err < 0)
+        //get data packets from out_q
+        pktbuf_t * pktbuf;
+        while ((pktbuf = netif_get_out_queue(netif, i, -1)))
         {
-            pktbuf_free(pktbuf);
-            return err;
+            //put data packet into the paired in_q
+            net_err_t err = netif_put_in_queue(netif, i, pktbuf, -1);
+            if (err < 0)
+            {
+                pktbuf_free(pktbuf);
+                return err;
+            }
         }
     }
     return NET_ERR_OK;
@@ -30,15 +30,72 @@ net_err_t mblock_init(mblock_t * mblock, void * mem, int blk_size, int cnt, lock
         }
     }
     mblock->start = mem;
+    mblock->blk_size = blk_size;
+    mblock->total = cnt;
+    mblock->max_cnt = 0;
+    mblock->slab_cnt = 0;
+    list_init(&mblock->slab_list);
     return NET_ERR_OK;
 }
 
+void mblock_set_grow(mblock_t * mblock, int slab_cnt, int max_cnt)
+{
+    //the alloc sem of a locked pool counts the static blocks only
+    if (mblock->locker.type != LOCKER_NONE)
+    {
+        debug_warn(DEBUG_MBLOCK, "locked mblock can not grow");
+        return;
+    }
+
+    mblock->slab_cnt = slab_cnt;
+    mblock->max_cnt = max_cnt;
+}
+
+/**
+ * carve a slab from the heap into free blocks, the slab's first bytes link it to slab_list
+ */
+static int mblock_grow(mblock_t * mblock)
+{
+    int cnt = mblock->max_cnt - mblock->total;
+    if (cnt > mblock->slab_cnt)
+    {
+        cnt = mblock->slab_cnt;
+    }
+    if (cnt <= 0)
+    {
+        return 0;
+    }
+
+    uint8_t * slab = (uint8_t *) plat_malloc(sizeof(node_t) + (size_t)mblock->blk_size * cnt);
+    if (!slab)
+    {
+        debug_warn(DEBUG_MBLOCK, "no heap for mblock slab");
+        return 0;
+    }
+
+    node_init((node_t *) slab);
+    list_insert_last(&mblock->slab_list, (node_t *) slab);
+
+    uint8_t * buf = slab + sizeof(node_t);
+    for (int i = 0; i < cnt; ++i, buf += mblock->blk_size) {
+        node_t * node = (node_t *) buf;
+        node_init(node);
+        list_insert_last(&mblock->free_list, node);
+    }
+    mblock->total += cnt;
+    return cnt;
+}
+
 void * mblock_alloc(mblock_t * block, int ms)
 {
     if ((ms < 0) || (block->locker.type == LOCKER_NONE))
     {
         locker_lock(&block->locker);
         int count = list_count(&block->free_list);
+        if ((count == 0) && (block->locker.type == LOCKER_NONE))
+        {
+            count = mblock_grow(block);
+        }
         if (count == 0)
         {
             locker_unlock(&block->locker);
@@ -95,4 +152,10 @@ void mblock_destroy(mblock_t * mblock)
         sys_sem_free(mblock->alloc_sem);
         locker_destroy(&mblock->locker);
     }
+
+    node_t * slab;
+    while ((slab = list_remove_first(&mblock->slab_list)))
+    {
+        plat_free(slab);
+    }
 }
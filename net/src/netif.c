@@ -6,11 +6,19 @@
 #include "pktbuf.h"
 #include "exmsg.h"
 #include "ipv4.h"
+#include "gso.h"
+#include "protocol.h"
+#include "ether.h"
+#include "tools.h"
 
 static netif_t netif_buffer[NETIF_DEV_CNT];
 static mblock_t netif_block;
 static list_t netif_list;
+//worker side busy poll, only touched by the work thread
+static netif_poll_t in_poll;
 static netif_t * netif_default;
+//filter built from the socket ports
+static netif_filter_t netif_filter;
 
 static const link_layer_t * link_layers[NETIF_TYPE_SIZE];
 
@@ -100,6 +108,47 @@ static const link_layer_t * netif_get_layer(int type)
     return link_layers[type];
 }
 
+static net_err_t queue_init(netif_queue_t * q)
+{
+    net_err_t err = fixq_init(&q->in_q, q->in_q_buf, NETIF_INQ_SIZE, LOCKER_THREAD);
+    if (err < 0)
+    {
+        debug_error(DEBUG_NETIF, "netif in_q init failed");
+        return err;
+    }
+    err = fixq_init(&q->out_q, q->out_q_buf, NETIF_OUTQ_SIZE, LOCKER_THREAD);
+    if (err < 0)
+    {
+        debug_error(DEBUG_NETIF, "netif out_q init failed");
+        fixq_destroy(&q->in_q);
+        return err;
+    }
+    return NET_ERR_OK;
+}
+
+/**
+ * free pktbufs still waiting in the queue pair
+ */
+static void queue_flush(netif_queue_t * q)
+{
+    pktbuf_t * buf;
+    while ((buf = fixq_recv(&q->in_q, -1)) != (pktbuf_t *) 0)
+    {
+        pktbuf_free(buf);
+    }
+    while ((buf = fixq_recv(&q->out_q, -1)) != (pktbuf_t *) 0)
+    {
+        pktbuf_free(buf);
+    }
+}
+
+static void queue_destroy(netif_queue_t * q)
+{
+    queue_flush(q);
+    fixq_destroy(&q->in_q);
+    fixq_destroy(&q->out_q);
+}
+
 netif_t * netif_open(const char * dev_name, const netif_ops_t * ops, void * ops_data)
 {
     netif_t * netif = (netif_t *) mblock_alloc(&netif_block, - 1);
@@ -116,22 +165,21 @@ netif_t * netif_open(const char * dev_name, const netif_ops_t * ops, void * ops_
     netif->name[NETIF_NAME_SIZE - 1] = '\0';
     netif->type = NETIF_TYPE_NONE;
     netif->mtu = 0;
+    netif->rcv_cfg.buf_size = NETIF_RCV_BUF_SIZE;
+    netif->rcv_cfg.immediate = NETIF_RCV_IMMEDIATE;
+    netif->rcv_cfg.burst = NETIF_RCV_BURST;
+    netif->busy_poll_max = 0;
+    netif->out_poll.budget = 0;
+    netif->forward = 0;
+    plat_memset(&netif->fwd_stats, 0, sizeof(netif->fwd_stats));
     node_init(&netif->node);
-    net_err_t err = fixq_init(&netif->in_q, netif->in_q_buf, NETIF_INQ_SIZE, LOCKER_THREAD);
-    if (err < 0)
-    {
-        debug_error(DEBUG_NETIF, "netif in_q init failed");
-        mblock_free(&netif_block, netif);
-        return (netif_t *) 0;
-    }
-    err = fixq_init(&netif->out_q, netif->out_q_buf, NETIF_OUTQ_SIZE, LOCKER_THREAD);
+    net_err_t err = queue_init(netif->queues);
     if (err < 0)
     {
-        debug_error(DEBUG_NETIF, "netif out_q init failed");
-        fixq_destroy(&netif->in_q);
         mblock_free(&netif_block, netif);
         return (netif_t *) 0;
     }
+    netif->queue_cnt = 1;
     netif->ops = ops;
     netif->ops_data = ops_data;
     err = ops->open(netif, ops_data);
@@ -163,8 +211,10 @@ netif_t * netif_open(const char * dev_name, const netif_ops_t * ops, void * ops_
     {
         netif->ops->close(netif);
     }
-    fixq_destroy(&netif->in_q);
-    fixq_destroy(&netif->out_q);
+    for (int i = 0; i < netif->queue_cnt; i++)
+    {
+        queue_destroy(netif->queues + i);
+    }
     mblock_free(&netif_block, netif);
     return (netif_t *)0;
 }
@@ -181,9 +231,86 @@ net_err_t netif_set_hwaddr(netif_t  * netif, const char * hwaddr, int len)
 {
     plat_memcpy(netif->hwaddr.addr, hwaddr, len);
     netif->hwaddr.len = len;
+    ipv4_dst_invalidate();
+    return NET_ERR_OK;
+}
+
+net_err_t netif_set_mtu(netif_t * netif, int mtu)
+{
+    //68: the smallest mtu every ipv4 host must accept
+    if ((mtu < 68) || (mtu > NETIF_MTU_MAX))
+    {
+        debug_error(DEBUG_NETIF, "invalid mtu: %d", mtu);
+        return NET_ERR_PARAM;
+    }
+    netif->mtu = mtu;
+    //cached destinations carry the path mtu
+    ipv4_dst_invalidate();
     return NET_ERR_OK;
 }
 
+void netif_set_forward(netif_t * netif, int enable)
+{
+    netif->forward = enable;
+
+    //forwarding needs traffic for other hosts' ports
+    if ((netif->state == NETIF_ACTIVE) && netif->ops->set_filter)
+    {
+        netif->ops->set_filter(netif, &netif_filter);
+    }
+}
+
+void netif_filter_add(netif_filter_t * filter, uint8_t protocol, uint16_t port)
+{
+    if (filter->all)
+    {
+        return;
+    }
+
+    uint16_t * ports = (protocol == NET_PROTOCOL_TCP) ? filter->tcp_ports : filter->udp_ports;
+    int * cnt = (protocol == NET_PROTOCOL_TCP) ? &filter->tcp_cnt : &filter->udp_cnt;
+    for (int i = 0; i < *cnt; i++)
+    {
+        if (ports[i] == port)
+        {
+            return;
+        }
+    }
+
+    if (*cnt >= NETIF_FILTER_PORTS)
+    {
+        //cleared so that all overflowed filters compare equal
+        plat_memset(filter, 0, sizeof(netif_filter_t));
+        filter->all = 1;
+        return;
+    }
+    ports[(*cnt)++] = port;
+}
+
+void netif_set_filter(const netif_filter_t * filter)
+{
+    if (!plat_memcmp(&netif_filter, filter, sizeof(netif_filter_t)))
+    {
+        return;
+    }
+    netif_filter = *filter;
+
+    node_t * node;
+    list_for_each(node, &netif_list)
+    {
+        netif_t * netif = list_node_parent(node, netif_t, node);
+        if ((netif->state != NETIF_ACTIVE) || !netif->ops->set_filter)
+        {
+            continue;
+        }
+
+        if (netif->ops->set_filter(netif, &netif_filter) < 0)
+        {
+            debug_warn(DEBUG_NETIF, "netif %s set filter failed", netif->name);
+        }
+    }
+}
+
 void ipaddr_copy(ipaddr_t * dest, const ipaddr_t * src)
 {
     if (!dest || !src)
@@ -232,6 +359,10 @@ net_err_t netif_set_active(netif_t * netif)
     rt_add(&netif->ipaddr, &ip2, ipaddr_get_any(), netif);
 
     netif->state = NETIF_ACTIVE;
+    if (netif->ops->set_filter && (netif->ops->set_filter(netif, &netif_filter) < 0))
+    {
+        debug_warn(DEBUG_NETIF, "netif %s set filter failed", netif->name);
+    }
     display_netif_list();
     return NET_ERR_OK;
 }
@@ -249,14 +380,9 @@ net_err_t netif_set_deactive(netif_t * netif)
     }
 
     //free pktbufs
-    pktbuf_t * buf;
-    while ((buf = fixq_recv(&netif->in_q, -1)) != (pktbuf_t *) 0)
+    for (int i = 0; i < netif->queue_cnt; i++)
     {
-        pktbuf_free(buf);
-    }
-    while ((buf = fixq_recv(&netif->out_q, -1)) != (pktbuf_t *) 0)
-    {
-        pktbuf_free(buf);
+        queue_flush(netif->queues + i);
     }
     if (netif_default == netif)
     {
@@ -286,6 +412,10 @@ net_err_t netif_close(netif_t * netif)
 
     netif->ops->close(netif);
     netif->state = NETIF_CLOSED;
+    for (int i = 0; i < netif->queue_cnt; i++)
+    {
+        queue_destroy(netif->queues + i);
+    }
     list_remove(&netif_list, &netif->node);
     mblock_free(&netif_block, netif);
 
@@ -310,22 +440,247 @@ netif_t * netif_get_default()
     return netif_default;
 }
 
+net_err_t netif_set_queue_cnt(netif_t * netif, int cnt)
+{
+    if (netif->state == NETIF_ACTIVE)
+    {
+        debug_error(DEBUG_NETIF, "netif is active");
+        return NET_ERR_STATE;
+    }
+
+    if ((cnt <= 0) || (cnt > NETIF_QUEUE_MAX))
+    {
+        debug_error(DEBUG_NETIF, "bad queue count: %d", cnt);
+        return NET_ERR_PARAM;
+    }
+
+    while (netif->queue_cnt < cnt)
+    {
+        net_err_t err = queue_init(netif->queues + netif->queue_cnt);
+        if (err < 0)
+        {
+            return err;
+        }
+        netif->queue_cnt++;
+    }
+
+    while (netif->queue_cnt > cnt)
+    {
+        queue_destroy(netif->queues + --netif->queue_cnt);
+    }
+    return NET_ERR_OK;
+}
+
 net_err_t netif_put_in(netif_t * netif, pktbuf_t * buf, int tmo)
 {
-    net_err_t err = fixq_send(&netif->in_q, buf, tmo);
+    //drivers hand over raw frames, hash them here so they spread over the queues
+    if ((netif->queue_cnt > 1) && !buf->flow_hash)
+    {
+        buf->flow_hash = netif_rx_hash(netif, buf);
+    }
+    return netif_put_in_queue(netif, netif_queue_select(netif, buf), buf, tmo);
+}
+
+net_err_t netif_put_in_queue(netif_t * netif, int qid, pktbuf_t * buf, int tmo)
+{
+    net_err_t err = fixq_send(&netif->queues[qid].in_q, buf, tmo);
     if (err < 0)
     {
         debug_warn(DEBUG_NETIF, "netif in_q is full");
         return NET_ERR_FULL;
     }
 
-    exmsg_netif_in(netif);
+    exmsg_netif_in(netif, qid);
+    return NET_ERR_OK;
+}
+
+int netif_put_in_burst(netif_t * netif, int qid, pktbuf_t ** bufs, int cnt)
+{
+    int n = fixq_send_burst(&netif->queues[qid].in_q, (void **)bufs, cnt);
+    if (n < cnt)
+    {
+        debug_warn(DEBUG_NETIF, "netif in_q is full");
+    }
+
+    if (n > 0)
+    {
+        exmsg_netif_in(netif, qid);
+    }
+    return n;
+}
+
+int netif_put_in_steer(netif_t * netif, pktbuf_t ** bufs, int cnt)
+{
+    if (netif->queue_cnt <= 1)
+    {
+        int n = netif_put_in_burst(netif, 0, bufs, cnt);
+        for (int i = n; i < cnt; i++)
+        {
+            pktbuf_free(bufs[i]);
+        }
+        return n;
+    }
+
+    //group by queue, then one burst per queue
+    pktbuf_t * queued[NETIF_QUEUE_MAX][NETIF_INQ_SIZE];
+    int queued_cnt[NETIF_QUEUE_MAX] = {0};
+    int total = 0;
+    for (int i = 0; i < cnt; i++)
+    {
+        bufs[i]->flow_hash = netif_rx_hash(netif, bufs[i]);
+        int qid = netif_queue_select(netif, bufs[i]);
+        if (queued_cnt[qid] >= NETIF_INQ_SIZE)
+        {
+            pktbuf_free(bufs[i]);
+            continue;
+        }
+        queued[qid][queued_cnt[qid]++] = bufs[i];
+    }
+
+    for (int qid = 0; qid < netif->queue_cnt; qid++)
+    {
+        int n = netif_put_in_burst(netif, qid, queued[qid], queued_cnt[qid]);
+        for (int i = n; i < queued_cnt[qid]; i++)
+        {
+            pktbuf_free(queued[qid][i]);
+        }
+        total += n;
+    }
+    return total;
+}
+
+uint32_t netif_rx_hash(netif_t * netif, pktbuf_t * buf)
+{
+    int link_size = 0;
+    if (netif->type == NETIF_TYPE_ETHER)
+    {
+        link_size = sizeof(ether_hdr_t);
+        if ((pktbuf_set_cont(buf, link_size) < 0)
+            || (x_ntohs(((ether_hdr_t *) pktbuf_data(buf))->protocol) != NET_PROTOCOL_IPV4))
+        {
+            return 0;
+        }
+    }
+
+    if (pktbuf_set_cont(buf, link_size + sizeof(ipv4_hdr_t)) < 0)
+    {
+        return 0;
+    }
+    ipv4_pkt_t * ip_pkt = (ipv4_pkt_t *) (pktbuf_data(buf) + link_size);
+    ipaddr_t src, dest;
+    ipaddr_from_buf(&src, ip_pkt->hdr.src_ip);
+    ipaddr_from_buf(&dest, ip_pkt->hdr.dest_ip);
+
+    //fragments carry no ports after the first, hash them by address alone
+    uint16_t sport = 0, dport = 0;
+    int ports_end = link_size + ipv4_hdr_size(ip_pkt) + 2 * sizeof(uint16_t);
+    if (((ip_pkt->hdr.protocol == NET_PROTOCOL_TCP) || (ip_pkt->hdr.protocol == NET_PROTOCOL_UDP))
+        && !(x_ntohs(ip_pkt->hdr.frag_all) & IP_FRAG_MASK)
+        && (pktbuf_set_cont(buf, ports_end) == NET_ERR_OK))
+    {
+        //set_cont may have moved the header
+        ip_pkt = (ipv4_pkt_t *) (pktbuf_data(buf) + link_size);
+        uint16_t * ports = (uint16_t *) ((uint8_t *) ip_pkt + ipv4_hdr_size(ip_pkt));
+        sport = x_ntohs(ports[0]);
+        dport = x_ntohs(ports[1]);
+    }
+    return flow_hash(&src, sport, &dest, dport);
+}
+
+int netif_out_pending(netif_t * netif)
+{
+    for (int i = 0; i < netif->queue_cnt; i++)
+    {
+        if (fixq_peek(&netif->queues[i].out_q))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+net_err_t netif_set_rcv_cfg(netif_t * netif, const netif_rcv_cfg_t * cfg)
+{
+    if ((cfg->buf_size <= 0) || (cfg->burst <= 0) || (cfg->burst > NETIF_INQ_SIZE))
+    {
+        debug_error(DEBUG_NETIF, "bad rcv cfg");
+        return NET_ERR_PARAM;
+    }
+
+    //the driver owns its handle, let it switch over in place
+    if ((netif->state != NETIF_CLOSED) && netif->ops->set_rcv_cfg)
+    {
+        net_err_t err = netif->ops->set_rcv_cfg(netif, cfg);
+        if (err < 0)
+        {
+            debug_error(DEBUG_NETIF, "netif %s set rcv cfg failed", netif->name);
+            return err;
+        }
+    }
+    netif->rcv_cfg = *cfg;
+    return NET_ERR_OK;
+}
+
+net_err_t netif_set_busy_poll(netif_t * netif, int max_us)
+{
+    if (max_us < 0)
+    {
+        debug_error(DEBUG_NETIF, "bad busy poll time: %d us", max_us);
+        return NET_ERR_PARAM;
+    }
+
+    netif->busy_poll_max = max_us;
+    netif->out_poll.budget = max_us;
+    sys_time_curr(&netif->out_poll.last);
     return NET_ERR_OK;
 }
 
+/**
+ * spin longer while packets come close together, back off when the link goes quiet
+ */
+static void poll_update(netif_poll_t * poll, int max_us)
+{
+    int gap = sys_time_goes(&poll->last);
+    if (gap <= NETIF_BUSY_POLL_GAP)
+    {
+        poll->budget = poll->budget ? poll->budget * 2 : NETIF_BUSY_POLL_MIN;
+        if (poll->budget > max_us)
+        {
+            poll->budget = max_us;
+        }
+    }
+    else
+    {
+        poll->budget /= 2;
+    }
+}
+
+void netif_poll_in_update(netif_t * netif)
+{
+    if (netif->busy_poll_max)
+    {
+        poll_update(&in_poll, netif->busy_poll_max);
+    }
+}
+
+void netif_poll_in_idle(void)
+{
+    in_poll.budget /= 2;
+}
+
+int netif_poll_budget(void)
+{
+    return in_poll.budget;
+}
+
 pktbuf_t * netif_get_in(netif_t * netif, int tmo)
 {
-    pktbuf_t * buf = fixq_recv(&netif->in_q, tmo);
+    return netif_get_in_queue(netif, 0, tmo);
+}
+
+pktbuf_t * netif_get_in_queue(netif_t * netif, int qid, int tmo)
+{
+    pktbuf_t * buf = fixq_recv(&netif->queues[qid].in_q, tmo);
     if (buf)
     {
         pktbuf_reset_access(buf);
@@ -338,7 +693,14 @@ pktbuf_t * netif_get_in(netif_t * netif, int tmo)
 
 net_err_t netif_put_out(netif_t * netif, pktbuf_t * buf, int tmo)
 {
-    net_err_t err = fixq_send(&netif->out_q, buf, tmo);
+    if (buf->gso_size)
+    {
+        //tcp or udp super-segment, cut it into gso_size frames here
+        return gso_put_out(netif, buf, tmo);
+    }
+
+    int qid = netif_queue_select(netif, buf);
+    net_err_t err = fixq_send(&netif->queues[qid].out_q, buf, tmo);
     if (err < 0)
     {
         debug_warn(DEBUG_NETIF, "netif out_q is full");
@@ -350,9 +712,32 @@ net_err_t netif_put_out(netif_t * netif, pktbuf_t * buf, int tmo)
 
 pktbuf_t * netif_get_out(netif_t * netif, int tmo)
 {
-    pktbuf_t * buf = fixq_recv(&netif->out_q, tmo);
+    return netif_get_out_queue(netif, 0, tmo);
+}
+
+pktbuf_t * netif_get_out_queue(netif_t * netif, int qid, int tmo)
+{
+    fixq_t * q = &netif->queues[qid].out_q;
+    pktbuf_t * buf = (pktbuf_t *) 0;
+    if ((tmo >= 0) && netif->out_poll.budget)
+    {
+        buf = fixq_poll(q, netif->out_poll.budget);
+        if (!buf)
+        {
+            //a whole spin found nothing, back off before sleeping
+            netif->out_poll.budget /= 2;
+        }
+    }
+    if (!buf)
+    {
+        buf = fixq_recv(q, tmo);
+    }
     if (buf)
     {
+        if (netif->busy_poll_max)
+        {
+            poll_update(&netif->out_poll, netif->busy_poll_max);
+        }
         pktbuf_reset_access(buf);
         return buf;
     }
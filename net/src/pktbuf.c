@@ -26,10 +26,11 @@ net_err_t pktbuf_init(void)
     return NET_ERR_OK;
 }
 
+/**
+ * caller holds locker
+ */
 static pktblk_t *pktblk_alloc() {
-    locker_lock(&locker);
     pktblk_t * block = mblock_alloc(&block_list, -1);
-    locker_unlock(&locker);
     if (block)
     {
         block->size = 0;
@@ -59,7 +60,10 @@ static void pktblk_free_list(pktblk_t * first)
     }
 }
 
-static pktblk_t * pktblk_alloc_list(int size, int add_front)
+/**
+ * caller holds locker, so a whole chain is one allocator transaction
+ */
+static pktblk_t * pktblk_take_list(int size, int add_front)
 {
     pktblk_t * first_block = (pktblk_t *)0;
     pktblk_t * pre_block = (pktblk_t *)0;
@@ -69,9 +73,11 @@ static pktblk_t * pktblk_alloc_list(int size, int add_front)
         if (!new_block)
         {
             debug_error(DEBUG_PKTBUF, "no buffer for alloc(%d)", size);
-            if (first_block)
+            while (first_block)
             {
-                pktblk_free_list(first_block);
+                pktblk_t * next = pktblk_blk_next(first_block);
+                mblock_free(&block_list, first_block);
+                first_block = next;
             }
             return (pktblk_t *)0;
         }
@@ -109,6 +115,14 @@ static pktblk_t * pktblk_alloc_list(int size, int add_front)
     return first_block;
 }
 
+static pktblk_t * pktblk_alloc_list(int size, int add_front)
+{
+    locker_lock(&locker);
+    pktblk_t * first_block = pktblk_take_list(size, add_front);
+    locker_unlock(&locker);
+    return first_block;
+}
+
 /**
  * insert pktblk_t into pktbuf_t
  * @param front if front equals 1, then insert into tail
@@ -169,35 +183,75 @@ static inline int curr_blk_remain(pktbuf_t * buf)
     return (int)(block->data + block->size - buf->blk_offset);
 }
 
-pktbuf_t * pktbuf_alloc(int size)
+/**
+ * caller holds locker
+ */
+static pktbuf_t * pktbuf_take(int size)
 {
-    locker_lock(&locker);
     pktbuf_t * buf = mblock_alloc(&pktbuf_list, -1);
-    locker_unlock(&locker);
     if (!buf) {
         debug_error(DEBUG_PKTBUF, "no buffer");
         return (pktbuf_t *)0;
     }
     buf->total_size = 0;
     buf->ref = 1;
+    buf->csum_valid = 0;
+    buf->flow_hash = 0;
+    buf->gso_size = buf->gso_segs = 0;
+    buf->gro = 0;
     list_init(&buf->blk_list);
     node_init(&buf->node);
 
     if(size) {
-        pktblk_t * block = pktblk_alloc_list(size, 1);
+        pktblk_t * block = pktblk_take_list(size, 1);
         if(!block) {
-            locker_lock(&locker);
             mblock_free(&pktbuf_list, buf);
-            locker_unlock(&locker);
             return (pktbuf_t *)0;
         }
         pktbuf_insert_blk_list(buf, block, 1);
     }
     pktbuf_reset_access(buf);
-    display_check_buf(buf);
     return buf;
 }
 
+pktbuf_t * pktbuf_alloc(int size)
+{
+    locker_lock(&locker);
+    pktbuf_t * buf = pktbuf_take(size);
+    locker_unlock(&locker);
+    if (buf)
+    {
+        display_check_buf(buf);
+    }
+    return buf;
+}
+
+int pktbuf_alloc_burst(pktbuf_t ** bufs, const int * sizes, int cnt)
+{
+    locker_lock(&locker);
+    int free_buf = mblock_free_cnt(&pktbuf_list);
+    int free_blk = mblock_free_cnt(&block_list);
+
+    int n;
+    for (n = 0; (n < cnt) && (n < free_buf); n++)
+    {
+        int blk_cnt = (sizes[n] + PKTBUF_BLK_SIZE - 1) / PKTBUF_BLK_SIZE;
+        if (blk_cnt > free_blk)
+        {
+            break;
+        }
+        free_blk -= blk_cnt;
+    }
+
+    //the pools are reserved above, so these can not fail
+    for (int i = 0; i < n; i++)
+    {
+        bufs[i] = pktbuf_take(sizes[i]);
+    }
+    locker_unlock(&locker);
+    return n;
+}
+
 void pktbuf_free(pktbuf_t * buf)
 {
     locker_lock(&locker);
@@ -391,6 +445,66 @@ net_err_t pktbuf_merge(pktbuf_t * dest, pktbuf_t * src)
     return NET_ERR_OK;
 }
 
+pktbuf_t * pktbuf_split(pktbuf_t * buf, int size)
+{
+    assert(buf->ref != 0, "buf ref == 0")
+    if (size > buf->total_size)
+    {
+        debug_error(DEBUG_PKTBUF, "size: %d > total_size: %d", size, buf->total_size);
+        return (pktbuf_t *)0;
+    }
+
+    //find the part of the block across the cut, alloc its copy first so nothing has to be undone
+    int part_size = size;
+    pktblk_t * block = pktbuf_first_blk(buf);
+    while (block && block->size <= part_size)
+    {
+        part_size -= block->size;
+        block = pktblk_blk_next(block);
+    }
+
+    pktbuf_t * head = pktbuf_alloc(0);
+    if (!head)
+    {
+        return (pktbuf_t *)0;
+    }
+
+    pktblk_t * part = (pktblk_t *)0;
+    if (part_size)
+    {
+        part = pktblk_alloc_list(part_size, 0);
+        if (!part)
+        {
+            pktbuf_free(head);
+            return (pktbuf_t *)0;
+        }
+    }
+
+    size -= part_size;
+    while (size)
+    {
+        pktblk_t * first = pktbuf_first_blk(buf);
+        list_remove_first(&buf->blk_list);
+        buf->total_size -= first->size;
+        size -= first->size;
+        pktbuf_insert_blk_list(head, first, 1);
+    }
+
+    if (part)
+    {
+        block = pktbuf_first_blk(buf);
+        plat_memcpy(part->data, block->data, part_size);
+        block->data += part_size;
+        block->size -= part_size;
+        buf->total_size -= part_size;
+        pktbuf_insert_blk_list(head, part, 1);
+    }
+
+    pktbuf_reset_access(buf);
+    display_check_buf(head);
+    return head;
+}
+
 net_err_t pktbuf_set_cont(pktbuf_t * buf, int size)
 {
     assert(buf->ref != 0, "buf ref == 0")
@@ -550,7 +664,7 @@ net_err_t pktbuf_seek(pktbuf_t * buf, int offset)
         return NET_ERR_OK;
     }
 
-    if (offset < 0 || (offset >= buf->total_size))
+    if (offset < 0 || (offset > buf->total_size))
     {
         return NET_ERR_PARAM;
     }
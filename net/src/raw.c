@@ -8,6 +8,7 @@
 #include "ipv4.h"
 #include "socket.h"
 #include "sock.h"
+#include "protocol.h"
 
 static raw_t raw_tbl[RAW_MAX_NR];
 static mblock_t raw_mblock;
@@ -117,6 +118,7 @@ static net_err_t raw_close(sock_t * sock)
 {
     raw_t * raw = (raw_t *) sock;
     list_remove(&raw_list, &sock->node);
+    sock_filter_update();
     node_t * node;
     while ((node= list_remove_first(&raw->recv_list)))
     {
@@ -179,6 +181,7 @@ sock_t * raw_create(int family, int protocol)
         goto create_failed;
     }
     list_insert_last(&raw_list, &raw->base.node);
+    sock_filter_update();
     return (sock_t*)raw;
 
     create_failed:
@@ -186,6 +189,23 @@ sock_t * raw_create(int family, int protocol)
     return (sock_t*)0;
 }
 
+void raw_filter_ports(netif_filter_t * filter)
+{
+    node_t * node;
+    list_for_each(node, &raw_list)
+    {
+        //icmp is always admitted, any other protocol can't be listed by port
+        sock_t * s = list_node_parent(node, sock_t, node);
+        if (s->protocol != NET_PROTOCOL_ICMPv4)
+        {
+            //cleared so that all overflowed filters compare equal
+            plat_memset(filter, 0, sizeof(netif_filter_t));
+            filter->all = 1;
+            return;
+        }
+    }
+}
+
 //find suitable raw_t
 static raw_t * raw_find(ipaddr_t * src, ipaddr_t * dest, uint8_t protocol)
 {
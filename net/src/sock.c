@@ -13,6 +13,10 @@
 #define SOCKET_MAX_NR   (RAW_MAX_NR + UDP_MAX_NR + TCP_MAX_NR)
 
 static x_socket_t socket_tbl[SOCKET_MAX_NR];
+//freed sockets, handed out again before the untouched tail of socket_tbl
+static list_t socket_free_list;
+//socket_tbl from here on has never been used
+static int socket_top;
 
 /**
  * get the index of the socket in socket_tbl
@@ -37,16 +41,22 @@ static x_socket_t * get_socket(int index)
  */
 static x_socket_t * socket_alloc()
 {
-    x_socket_t * s = (x_socket_t*)0;
-    for (int i = 0; i < SOCKET_MAX_NR; ++i) {
-        x_socket_t * curr = socket_tbl + i;
-        if (curr->state == SOCKET_STATE_FREE)
-        {
-            curr->state = SOCKET_STATE_USED;
-            s = curr;
-            break;
-        }
+    x_socket_t * s;
+    node_t * node = list_remove_first(&socket_free_list);
+    if (node)
+    {
+        s = list_node_parent(node, x_socket_t, node);
     }
+    else if (socket_top < SOCKET_MAX_NR)
+    {
+        s = socket_tbl + socket_top++;
+    }
+    else
+    {
+        return (x_socket_t*)0;
+    }
+
+    s->state = SOCKET_STATE_USED;
     return s;
 }
 
@@ -56,12 +66,15 @@ static x_socket_t * socket_alloc()
 static void socket_free(x_socket_t * s)
 {
     s->state = SOCKET_STATE_FREE;
+    list_insert_first(&socket_free_list, &s->node);
 }
 
 
 net_err_t socket_init()
 {
-    plat_memset(socket_tbl, 0, sizeof(socket_tbl));
+    //socket_tbl is zeroed as a static, leave its pages alone until used
+    list_init(&socket_free_list);
+    socket_top = 0;
     return NET_ERR_OK;
 }
 
@@ -77,10 +90,13 @@ net_err_t sock_init(sock_t * sock, int family, int protocol, const sock_ops_t *
     sock->remote_port = 0;
     sock->err = NET_ERR_OK;
     sock->rcv_tmo = 0;
+    sock->reuseport = 0;
     sock->send_tmo = 0;
     sock->rcv_wait = (sock_wait_t *)0;
     sock->snd_wait = (sock_wait_t *)0;
     sock->conn_wait = (sock_wait_t *)0;
+    sock->dst.gen = 0;
+    sock->dst.df = 0;
     node_init(&sock->node);
     return NET_ERR_OK;
 }
@@ -124,23 +140,36 @@ void sock_wakeup(sock_t * sock, int type, int err)
 
 net_err_t sock_wait_init(sock_wait_t * wait)
 {
+    //the sem comes with the first wait, most sockets never block
     wait->waiting = 0;
     wait->err = NET_ERR_OK;
-    wait->sem = sys_sem_create(0);
-    return wait->sem == SYS_SEM_INVALID ? NET_ERR_SYS : NET_ERR_OK;
+    wait->sem = SYS_SEM_INVALID;
+    return NET_ERR_OK;
 }
 
 void sock_wait_destroy(sock_wait_t * wait)
 {
     if (wait->sem != SYS_SEM_INVALID)
         sys_sem_free(wait->sem);
+    wait->sem = SYS_SEM_INVALID;
 }
 
-void sock_wait_add(sock_wait_t * wait, int tmo, sock_req_t * req)
+net_err_t sock_wait_add(sock_wait_t * wait, int tmo, sock_req_t * req)
 {
+    if (wait->sem == SYS_SEM_INVALID)
+    {
+        wait->sem = sys_sem_create(0);
+        if (wait->sem == SYS_SEM_INVALID)
+        {
+            debug_error(DEBUG_SOCKET, "create wait sem failed");
+            return NET_ERR_SYS;
+        }
+    }
+
     wait->waiting++;
     req->wait = wait;
     req->wait_tmo = tmo;
+    return NET_ERR_NEED_WAIT;
 }
 
 net_err_t sock_wait_enter(sock_wait_t * wait, int tmo)
@@ -231,7 +260,7 @@ net_err_t sock_sendto_req_in(struct func_msg_t * msg)
     {
         if (sock->snd_wait)
         {
-            sock_wait_add(sock->snd_wait, sock->send_tmo, req);
+            err = sock_wait_add(sock->snd_wait, sock->send_tmo, req);
         }
     }
 
@@ -273,7 +302,7 @@ net_err_t sock_send_req_in(struct func_msg_t * msg)
     {
         if (sock->snd_wait)
         {
-            sock_wait_add(sock->snd_wait, sock->send_tmo, req);
+            err = sock_wait_add(sock->snd_wait, sock->send_tmo, req);
         }
     }
 
@@ -304,7 +333,7 @@ net_err_t sock_recvfrom_req_in(struct func_msg_t * msg)
     {
         if (sock->rcv_wait)
         {
-            sock_wait_add(sock->rcv_wait, sock->rcv_tmo, req);
+            err = sock_wait_add(sock->rcv_wait, sock->rcv_tmo, req);
         }
     }
 
@@ -342,10 +371,128 @@ net_err_t sock_recv_req_in(struct func_msg_t * msg)
     {
         if (sock->rcv_wait)
         {
-            sock_wait_add(sock->rcv_wait, sock->rcv_tmo, req);
+            err = sock_wait_add(sock->rcv_wait, sock->rcv_tmo, req);
+        }
+    }
+
+    return err;
+}
+
+net_err_t sock_sendmmsg_req_in(struct func_msg_t * msg)
+{
+    sock_req_t * req = (sock_req_t *)msg->param;
+
+    x_socket_t * s = get_socket(req->sockfd);
+    if (!s)
+    {
+        debug_error(DEBUG_SOCKET, "param error");
+        return NET_ERR_PARAM;
+    }
+
+    sock_t * sock = s->sock;
+    sock_mmsg_t * mmsg = &req->mmsg;
+    if (!sock->ops->sendto)
+    {
+        debug_error(DEBUG_SOCKET, "sendto func no impl");
+        return NET_ERR_NONE;
+    }
+
+    //stop at the first failure, what went out so far still counts
+    net_err_t err = NET_ERR_OK;
+    for (mmsg->comp_cnt = 0; mmsg->comp_cnt < mmsg->cnt; mmsg->comp_cnt++)
+    {
+        struct x_mmsghdr * m = mmsg->msgs + mmsg->comp_cnt;
+        m->comp_len = 0;
+        if (m->addr)
+        {
+            err = sock->ops->sendto(sock, m->buf, m->len, mmsg->flags, m->addr, m->addr_len, &m->comp_len);
+        }
+        else
+        {
+            err = sock_send(sock, m->buf, m->len, mmsg->flags, &m->comp_len);
+        }
+        if (err < 0)
+        {
+            break;
+        }
+    }
+    return mmsg->comp_cnt ? NET_ERR_OK : err;
+}
+
+net_err_t sock_recvmmsg_req_in(struct func_msg_t * msg)
+{
+    sock_req_t * req = (sock_req_t *)msg->param;
+
+    x_socket_t * s = get_socket(req->sockfd);
+    if (!s)
+    {
+        debug_error(DEBUG_SOCKET, "param error");
+        return NET_ERR_PARAM;
+    }
+
+    sock_t * sock = s->sock;
+    sock_mmsg_t * mmsg = &req->mmsg;
+    if (!sock->ops->recvfrom)
+    {
+        debug_error(DEBUG_SOCKET, "recvfrom func no impl");
+        return NET_ERR_NONE;
+    }
+
+    //drain what is queued, only wait when nothing is
+    net_err_t err = NET_ERR_OK;
+    for (mmsg->comp_cnt = 0; mmsg->comp_cnt < mmsg->cnt; mmsg->comp_cnt++)
+    {
+        struct x_mmsghdr * m = mmsg->msgs + mmsg->comp_cnt;
+        struct x_sockaddr_in from;
+        x_socklen_t from_len = sizeof(from);
+        m->comp_len = 0;
+        err = sock->ops->recvfrom(sock, m->buf, m->len, mmsg->flags,
+                                  m->addr ? m->addr : (struct x_sockaddr *)&from,
+                                  m->addr ? &m->addr_len : &from_len, &m->comp_len);
+        if (err != NET_ERR_OK)
+        {
+            break;
         }
     }
+    if (mmsg->comp_cnt)
+    {
+        return NET_ERR_OK;
+    }
+
+    if ((err == NET_ERR_NEED_WAIT) && sock->rcv_wait)
+    {
+        err = sock_wait_add(sock->rcv_wait, sock->rcv_tmo, req);
+    }
+    return err;
+}
+
+net_err_t sock_recv_view_req_in(struct func_msg_t * msg)
+{
+    sock_req_t * req = (sock_req_t *)msg->param;
+
+    x_socket_t * s = get_socket(req->sockfd);
+    if (!s)
+    {
+        debug_error(DEBUG_SOCKET, "param error");
+        return NET_ERR_PARAM;
+    }
 
+    sock_t * sock = s->sock;
+    sock_view_t * view = &req->view;
+    if (!sock->ops->recvbuf)
+    {
+        debug_error(DEBUG_SOCKET, "recvbuf func no impl");
+        return NET_ERR_NONE;
+    }
+
+    net_err_t err = sock->ops->recvbuf(sock, &view->buf, view->flags, view->addr, view->addr_len);
+    if (err == NET_ERR_NEED_WAIT)
+    {
+        if (sock->rcv_wait)
+        {
+            err = sock_wait_add(sock->rcv_wait, sock->rcv_tmo, req);
+        }
+    }
     return err;
 }
 
@@ -377,6 +524,22 @@ net_err_t sock_setopt(struct sock_t * s, int level, int optname, const char * op
                 s->send_tmo = time_ms;
                 return NET_ERR_OK;
             }
+            break;
+        case SO_REUSEPORT:
+            if (optlen != sizeof(int))
+            {
+                debug_error(DEBUG_SOCKET, "param size error");
+                return NET_ERR_PARAM;
+            }
+
+            //group membership is decided at bind time
+            if (s->local_port != 0)
+            {
+                debug_error(DEBUG_SOCKET, "reuseport must be set before bind");
+                return NET_ERR_STATE;
+            }
+            s->reuseport = *(const int *)optval ? 1 : 0;
+            return NET_ERR_OK;
         default:
             break;
     }
@@ -422,10 +585,15 @@ net_err_t sock_close_req_in(struct func_msg_t * msg)
     {
         if (sock->conn_wait)
         {
-            sock_wait_add(sock->conn_wait, NET_CLOSE_MAX_TMO, req);
+            err = sock_wait_add(sock->conn_wait, NET_CLOSE_MAX_TMO, req);
         }
     }
-    socket_free(s);
+
+    //otherwise the destroy request that follows frees it
+    if (err == NET_ERR_OK)
+    {
+        socket_free(s);
+    }
     return err;
 }
 
@@ -469,7 +637,7 @@ net_err_t sock_connect_req_in(struct func_msg_t * msg)
     {
         if (sock->conn_wait)
         {
-            sock_wait_add(sock->conn_wait, sock->rcv_tmo, req);
+            err = sock_wait_add(sock->conn_wait, sock->rcv_tmo, req);
         }
     }
     return err;
@@ -541,7 +709,7 @@ net_err_t sock_accept_req_in(struct func_msg_t * msg)
     {
         if (sock->conn_wait)
         {
-            sock_wait_add(sock->conn_wait, sock->rcv_tmo, req);
+            err = sock_wait_add(sock->conn_wait, sock->rcv_tmo, req);
         }
     }
     else
@@ -556,7 +724,7 @@ net_err_t sock_accept_req_in(struct func_msg_t * msg)
         accept->client = get_index(child_socket);
     }
 
-    return NET_ERR_OK;
+    return err;
 }
 
 net_err_t sock_connect(sock_t * sock, const struct x_sockaddr * addr, x_socklen_t len)
@@ -578,7 +746,7 @@ net_err_t sock_bind(struct sock_t * s, const struct x_sockaddr * addr, x_socklen
     if (!ipaddr_is_any(&local_ip))
     {
         rentry_t * rt = rt_find(&local_ip);
-        if (!rt || (ipaddr_is_equal(&rt->netif->ipaddr, &local_ip)))
+        if (!rt || !ipaddr_is_equal(&rt->netif->ipaddr, &local_ip))
         {
             debug_error(DEBUG_SOCKET, "addr error");
             return NET_ERR_PARAM;
@@ -588,4 +756,14 @@ net_err_t sock_bind(struct sock_t * s, const struct x_sockaddr * addr, x_socklen
     ipaddr_copy(&s->local_ip, &local_ip);
     s->local_port = x_ntohs(local->sin_port);
     return NET_ERR_OK;
-}
\ No newline at end of file
+}
+
+void sock_filter_update(void)
+{
+    netif_filter_t filter;
+    plat_memset(&filter, 0, sizeof(filter));
+    udp_filter_ports(&filter);
+    tcp_filter_ports(&filter);
+    raw_filter_ports(&filter);
+    netif_set_filter(&filter);
+}
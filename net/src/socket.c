@@ -214,6 +214,137 @@ ssize_t x_recv(int s, const void * buf, size_t len, int flags)
     }
 }
 
+int x_sendmmsg(int s, struct x_mmsghdr * msgs, unsigned int cnt, int flags)
+{
+    if (!msgs || !cnt)
+    {
+        debug_error(DEBUG_SOCKET, "invalid param");
+        return -1;
+    }
+
+    sock_req_t req;
+    req.sockfd = s;
+    req.wait = (sock_wait_t *)0;
+    req.wait_tmo = 0;
+    req.mmsg.msgs = msgs;
+    req.mmsg.cnt = (int)cnt;
+    req.mmsg.flags = flags;
+    req.mmsg.comp_cnt = 0;
+    net_err_t err = exmsg_func_exec(sock_sendmmsg_req_in, &req);
+    if (err < 0)
+    {
+        debug_info(DEBUG_SOCKET, "sendmmsg failed");
+        return -1;
+    }
+    return req.mmsg.comp_cnt;
+}
+
+int x_recvmmsg(int s, struct x_mmsghdr * msgs, unsigned int cnt, int flags)
+{
+    if (!msgs || !cnt)
+    {
+        debug_error(DEBUG_SOCKET, "invalid param");
+        return -1;
+    }
+
+    while (1)
+    {
+        sock_req_t req;
+        req.sockfd = s;
+        req.wait = (sock_wait_t *)0;
+        req.wait_tmo = 0;
+        req.mmsg.msgs = msgs;
+        req.mmsg.cnt = (int)cnt;
+        req.mmsg.flags = flags;
+        req.mmsg.comp_cnt = 0;
+        net_err_t err = exmsg_func_exec(sock_recvmmsg_req_in, &req);
+        if (err < 0)
+        {
+            debug_info(DEBUG_SOCKET, "recvmmsg failed");
+            return -1;
+        }
+
+        if (req.mmsg.comp_cnt)
+        {
+            return req.mmsg.comp_cnt;
+        }
+
+        err = sock_wait_enter(req.wait, req.wait_tmo);
+        if (err < 0)
+        {
+            debug_error(DEBUG_SOCKET, "recv failed");
+            return -1;
+        }
+    }
+}
+
+ssize_t x_recv_view(int s, struct x_recv_view * view, int flags)
+{
+    if (!view)
+    {
+        debug_error(DEBUG_SOCKET, "invalid param");
+        return -1;
+    }
+
+    while (1)
+    {
+        x_socklen_t from_len = sizeof(view->from);
+        sock_req_t req;
+        req.wait = (sock_wait_t *)0;
+        req.wait_tmo = 0;
+        req.sockfd = s;
+        req.view.buf = (pktbuf_t *)0;
+        req.view.flags = flags;
+        req.view.addr = (struct x_sockaddr *)&view->from;
+        req.view.addr_len = &from_len;
+        net_err_t err = exmsg_func_exec(sock_recv_view_req_in, &req);
+        if (err < 0)
+        {
+            debug_info(DEBUG_SOCKET, "recv view failed");
+            return -1;
+        }
+
+        if (req.view.buf)
+        {
+            //the buf is ours now, its blocks can be walked outside the worker
+            view->buf = req.view.buf;
+            view->blk = pktbuf_first_blk(view->buf);
+            view->len = view->buf->total_size;
+            return (ssize_t)view->len;
+        }
+
+        err = sock_wait_enter(req.wait, req.wait_tmo);
+        if (err < 0)
+        {
+            debug_error(DEBUG_SOCKET, "recv failed");
+            return -1;
+        }
+    }
+}
+
+size_t x_view_next(struct x_recv_view * view, const void ** data)
+{
+    pktblk_t * blk = view->blk;
+    if (!blk)
+    {
+        return 0;
+    }
+
+    *data = blk->data;
+    view->blk = pktblk_blk_next(blk);
+    return (size_t)blk->size;
+}
+
+void x_recv_release(struct x_recv_view * view)
+{
+    if (view->buf)
+    {
+        pktbuf_free(view->buf);
+        view->buf = (pktbuf_t *)0;
+        view->blk = (pktblk_t *)0;
+    }
+}
+
 int x_setsockopt(int s, int level, int optname, const char * optval, int len)
 {
     if (!optval || !len)
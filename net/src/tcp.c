@@ -11,9 +11,27 @@
 #include "tcp_out.h"
 #include "tcp_state.h"
 
-static tcp_t tcp_tbl[TCP_MAX_NR];
+//first blocks of the pools, the rest are grown from the heap on demand
+static tcp_t tcp_tbl[TCP_INIT_NR];
 static mblock_t tcp_mblock;
 static list_t tcp_list;
+//TIME_WAIT sockets, oldest first, recycled when no tcp is left
+static list_t tcp_tw_list;
+//senders blocked because no send storage was left, oldest first
+static list_t tcp_sbuf_wait_list;
+//sockets with a local port and no remote, by local port
+static list_t tcp_port_hash[TCP_HASH_SIZE];
+//sockets with a remote, by 4-tuple
+static list_t tcp_conn_hash[TCP_CONN_HASH_SIZE];
+//local ports in use, by port
+static list_t tcp_bind_hash[TCP_HASH_SIZE];
+static tcp_bind_t tcp_bind_tbl[TCP_INIT_NR];
+static mblock_t tcp_bind_mblock;
+//snd/rcv buffer storage
+static uint8_t tcp_sbuf_tbl[TCP_BUF_INIT_NR][TCP_SBUF_SIZE];
+static mblock_t tcp_sbuf_mblock;
+static uint8_t tcp_rbuf_tbl[TCP_BUF_INIT_NR][TCP_RBUF_SIZE];
+static mblock_t tcp_rbuf_mblock;
 
 #if DEBUG_DISP_ENABLED(DEBUG_TCP)
 void tcp_show_info(char * msg, tcp_t * tcp)
@@ -68,24 +86,229 @@ net_err_t tcp_init()
 {
     debug_info(DEBUG_TCP, "tcp init");
     list_init(&tcp_list);
-    mblock_init(&tcp_mblock, tcp_tbl, sizeof(tcp_t), TCP_MAX_NR, LOCKER_NONE);
+    list_init(&tcp_tw_list);
+    list_init(&tcp_sbuf_wait_list);
+    for (int i = 0; i < TCP_HASH_SIZE; i++)
+    {
+        list_init(tcp_port_hash + i);
+        list_init(tcp_bind_hash + i);
+    }
+    for (int i = 0; i < TCP_CONN_HASH_SIZE; i++)
+    {
+        list_init(tcp_conn_hash + i);
+    }
+    mblock_init(&tcp_mblock, tcp_tbl, sizeof(tcp_t), TCP_INIT_NR, LOCKER_NONE);
+    mblock_set_grow(&tcp_mblock, TCP_SLAB_NR, TCP_MAX_NR);
+    mblock_init(&tcp_bind_mblock, tcp_bind_tbl, sizeof(tcp_bind_t), TCP_INIT_NR, LOCKER_NONE);
+    mblock_set_grow(&tcp_bind_mblock, TCP_SLAB_NR, TCP_MAX_NR);
+    mblock_init(&tcp_sbuf_mblock, tcp_sbuf_tbl, TCP_SBUF_SIZE, TCP_BUF_INIT_NR, LOCKER_NONE);
+    mblock_set_grow(&tcp_sbuf_mblock, TCP_BUF_SLAB_NR, TCP_BUF_MAX_NR);
+    mblock_init(&tcp_rbuf_mblock, tcp_rbuf_tbl, TCP_RBUF_SIZE, TCP_BUF_INIT_NR, LOCKER_NONE);
+    mblock_set_grow(&tcp_rbuf_mblock, TCP_BUF_SLAB_NR, TCP_BUF_MAX_NR);
+    return NET_ERR_OK;
+}
+
+static list_t * port_bucket(list_t * tbl, uint16_t port)
+{
+    return tbl + (port % TCP_HASH_SIZE);
+}
+
+static list_t * conn_bucket(uint16_t local_port, ipaddr_t * remote_ip, uint16_t remote_port)
+{
+    uint32_t hash = remote_ip->q_addr ^ (((uint32_t)remote_port << 16) | local_port);
+    hash *= 0x9E3779B1;
+    return tcp_conn_hash + ((hash >> 16) % TCP_CONN_HASH_SIZE);
+}
+
+static tcp_bind_t * tcp_bind_find(uint16_t port)
+{
+    node_t * node;
+    list_for_each(node, port_bucket(tcp_bind_hash, port))
+    {
+        tcp_bind_t * bind = list_node_parent(node, tcp_bind_t, node);
+        if (bind->port == port)
+        {
+            return bind;
+        }
+    }
+    return (tcp_bind_t *)0;
+}
+
+/**
+ * take a reference on tcp's local port, the netif filter follows the ports in use
+ */
+static net_err_t tcp_bind_get(tcp_t * tcp)
+{
+    uint16_t port = tcp->base.local_port;
+    tcp_bind_t * bind = tcp_bind_find(port);
+    if (!bind)
+    {
+        bind = mblock_alloc(&tcp_bind_mblock, -1);
+        if (!bind)
+        {
+            debug_error(DEBUG_TCP, "no tcp bind");
+            return NET_ERR_MEM;
+        }
+        bind->port = port;
+        bind->ref = 0;
+        node_init(&bind->node);
+        list_insert_last(port_bucket(tcp_bind_hash, port), &bind->node);
+        sock_filter_update();
+    }
+    bind->ref++;
+    tcp->bind = bind;
+    return NET_ERR_OK;
+}
+
+static void tcp_bind_put(tcp_t * tcp)
+{
+    tcp_bind_t * bind = tcp->bind;
+    if (!bind)
+    {
+        return;
+    }
+
+    tcp->bind = (tcp_bind_t *)0;
+    if (--bind->ref == 0)
+    {
+        list_remove(port_bucket(tcp_bind_hash, bind->port), &bind->node);
+        mblock_free(&tcp_bind_mblock, bind);
+        sock_filter_update();
+    }
+}
+
+static void tcp_unhash(tcp_t * tcp)
+{
+    if (tcp->port_bucket)
+    {
+        list_remove(tcp->port_bucket, &tcp->port_node);
+        tcp->port_bucket = (list_t *)0;
+    }
+    if (tcp->conn_bucket)
+    {
+        list_remove(tcp->conn_bucket, &tcp->conn_node);
+        tcp->conn_bucket = (list_t *)0;
+    }
+}
+
+/**
+ * file tcp under its current addresses, called whenever they change
+ */
+static net_err_t tcp_rehash(tcp_t * tcp)
+{
+    sock_t * s = &tcp->base;
+    tcp_unhash(tcp);
+    if (!s->local_port)
+    {
+        return NET_ERR_OK;
+    }
+
+    if (!tcp->bind && (tcp_bind_get(tcp) < 0))
+    {
+        return NET_ERR_MEM;
+    }
+    if (s->remote_port)
+    {
+        tcp->conn_bucket = conn_bucket(s->local_port, &s->remote_ip, s->remote_port);
+        list_insert_last(tcp->conn_bucket, &tcp->conn_node);
+    }
+    else
+    {
+        tcp->port_bucket = port_bucket(tcp_port_hash, s->local_port);
+        list_insert_last(tcp->port_bucket, &tcp->port_node);
+    }
     return NET_ERR_OK;
 }
 
+static mblock_t * tcp_buf_mblock(tcp_t * tcp, tcp_buf_t * buf)
+{
+    return (buf == &tcp->snd.buf) ? &tcp_sbuf_mblock : &tcp_rbuf_mblock;
+}
+
+net_err_t tcp_attach_buf(tcp_t * tcp, tcp_buf_t * buf)
+{
+    if (buf->data)
+    {
+        return NET_ERR_OK;
+    }
+
+    buf->data = mblock_alloc(tcp_buf_mblock(tcp, buf), -1);
+    if (!buf->data)
+    {
+        debug_warn(DEBUG_TCP, "no tcp buffer");
+        return NET_ERR_MEM;
+    }
+    return NET_ERR_OK;
+}
+
+static void tcp_sbuf_wait(tcp_t * tcp, int enter)
+{
+    if (enter && !tcp->flags.sbuf_wait)
+    {
+        list_insert_last(&tcp_sbuf_wait_list, &tcp->sbuf_node);
+        tcp->flags.sbuf_wait = 1;
+    }
+    else if (!enter && tcp->flags.sbuf_wait)
+    {
+        list_remove(&tcp_sbuf_wait_list, &tcp->sbuf_node);
+        tcp->flags.sbuf_wait = 0;
+    }
+}
+
+/**
+ * hand freed send storage to the oldest sender still blocked on it
+ */
+static void tcp_sbuf_wakeup(void)
+{
+    node_t * node;
+    while ((node = list_remove_first(&tcp_sbuf_wait_list)) != (node_t *)0)
+    {
+        tcp_t * tcp = list_node_parent(node, tcp_t, sbuf_node);
+        tcp->flags.sbuf_wait = 0;
+        //its send may have timed out since, then try the next one
+        if (tcp->snd.wait.waiting > 0)
+        {
+            sock_wakeup(&tcp->base, SOCK_WAIT_WRITE, NET_ERR_OK);
+            return;
+        }
+    }
+}
+
+void tcp_detach_buf(tcp_t * tcp, tcp_buf_t * buf)
+{
+    if (buf->data)
+    {
+        mblock_free(tcp_buf_mblock(tcp, buf), buf->data);
+        if (buf == &tcp->snd.buf)
+        {
+            tcp_sbuf_wakeup();
+        }
+    }
+    tcp_buf_init(buf, (uint8_t *)0, buf->size);
+}
+
+void tcp_timewait_track(tcp_t * tcp, int enter)
+{
+    if (enter)
+    {
+        list_insert_last(&tcp_tw_list, &tcp->tw_node);
+    }
+    else
+    {
+        list_remove(&tcp_tw_list, &tcp->tw_node);
+    }
+}
+
 static tcp_t * tcp_get_free(int wait)
 {
     tcp_t * tcp = mblock_alloc(&tcp_mblock, wait ? 0 : -1);
     if (!tcp)
     {
-        node_t * node;
-        list_for_each(node, &tcp_list)
+        node_t * node = list_first(&tcp_tw_list);
+        if (node)
         {
-            tcp_t * s = (tcp_t *) list_node_parent(node, sock_t, node);
-            if(s->state == TCP_STATE_TIME_WAIT)
-            {
-                tcp_free(s);
-                return (tcp_t *) mblock_alloc(&tcp_mblock, -1);
-            }
+            tcp_free(list_node_parent(node, tcp_t, tw_node));
+            return (tcp_t *) mblock_alloc(&tcp_mblock, -1);
         }
     }
     return tcp;
@@ -94,30 +317,23 @@ static tcp_t * tcp_get_free(int wait)
 /** alloc port for tcp connection **/
 static int tcp_alloc_port()
 {
-#if 1
-    srand((unsigned int)time(NULL));
-    int num = rand() % 1000;
-    int search_index = num + NET_PORT_DYN_START;
-#else
-    static int search_index = NET_PORT_DYN_START;
-#endif
+    //random start, then keep going round so a closed port is not reused at once
+    static int search_index = NET_PORT_EMPTY;
+    if (search_index == NET_PORT_EMPTY)
+    {
+        srand((unsigned int)time(NULL));
+        search_index = rand() % 1000 + NET_PORT_DYN_START;
+    }
+
     for (int i = NET_PORT_DYN_START; i < NET_PORT_DYN_END; ++i) {
-        node_t * node;
-        list_for_each(node, &tcp_list)
-        {
-            sock_t * sock = list_node_parent(node, sock_t, node);
-            if (sock->local_port == search_index)
-            {
-                break;
-            }
-        }
+        int port = search_index;
         if (++search_index >= NET_PORT_DYN_END)
         {
             search_index = NET_PORT_DYN_START;
         }
-        if (!node)
+        if (!tcp_bind_find(port))
         {
-            return search_index;
+            return port;
         }
     }
 
@@ -130,22 +346,33 @@ static uint32_t tcp_get_iss()
     return ++seq;
 }
 
-static net_err_t tcp_init_connect(tcp_t * tcp)
+void tcp_update_mss(tcp_t * tcp)
 {
-    rentry_t * rt = rt_find(&tcp->base.remote_ip);
-    if (rt->netif->mtu == 0 || !ipaddr_is_any(&rt->next_hop))
+    ip_dst_t * dst = &tcp->base.dst;
+    if ((ipv4_dst_update(dst, &tcp->base.remote_ip) < 0) || !dst->mtu)
     {
-        tcp->mss = TCP_DEFAULT_MSS;
+        return;
     }
-    else
+
+    int mss = (int) (dst->mtu - sizeof(ipv4_hdr_t) - sizeof(tcp_hdr_t));
+    if (tcp->mss_peer && (mss > tcp->mss_peer))
     {
-        tcp->mss = (int) (rt->netif->mtu - sizeof(ipv4_hdr_t) - sizeof(tcp_hdr_t));
+        mss = tcp->mss_peer;
     }
+    tcp->mss = mss;
+}
+
+static net_err_t tcp_init_connect(tcp_t * tcp)
+{
+    //start at the first hop mtu, icmp fragmentation needed lowers it (rfc 1191)
+    tcp->mss = TCP_DEFAULT_MSS;
+    tcp->mss_peer = 0;
+    tcp_update_mss(tcp);
 
-    tcp_buf_init(&tcp->snd.buf, tcp->snd.data, TCP_SBUF_SIZE);
+    tcp_buf_init(&tcp->snd.buf, (uint8_t *)0, TCP_SBUF_SIZE);
     tcp->snd.iss = tcp_get_iss();
     tcp->snd.una = tcp->snd.nxt = tcp->snd.iss;
-    tcp_buf_init(&tcp->rcv.buf, tcp->rcv.data, TCP_RBUF_SIZE);
+    tcp_buf_init(&tcp->rcv.buf, (uint8_t *)0, TCP_RBUF_SIZE);
     tcp->rcv.nxt = 0;
     return NET_ERR_OK;
 }
@@ -188,7 +415,14 @@ static net_err_t tcp_connect(struct sock_t * s, const struct x_sockaddr * addr,
         ipaddr_copy(&s->local_ip, &rt->netif->ipaddr);
     }
 
-    net_err_t err = tcp_init_connect(tcp);
+    net_err_t err = tcp_rehash(tcp);
+    if (err < 0)
+    {
+        debug_error(DEBUG_TCP, "hash tcp failed");
+        return err;
+    }
+
+    err = tcp_init_connect(tcp);
     if (err < 0)
     {
         debug_error(DEBUG_TCP, "init tcp conn failed");
@@ -204,25 +438,51 @@ static net_err_t tcp_connect(struct sock_t * s, const struct x_sockaddr * addr,
     return NET_ERR_NEED_WAIT;
 }
 
+void tcp_clear_parent(tcp_t * tcp)
+{
+    node_t * node;
+    while ((node = list_remove_first(&tcp->child_list)))
+    {
+        tcp_t * child = list_node_parent(node, tcp_t, child_node);
+        child->parent = (tcp_t *)0;
+    }
+}
+
 void tcp_free(tcp_t * tcp)
 {
+    tcp_kill_all_timers(tcp);
+    if (tcp->state == TCP_STATE_TIME_WAIT)
+    {
+        tcp_timewait_track(tcp, 0);
+    }
+    tcp_sbuf_wait(tcp, 0);
+    tcp_detach_buf(tcp, &tcp->snd.buf);
+    tcp_detach_buf(tcp, &tcp->rcv.buf);
     sock_wait_destroy(&tcp->conn.wait);
     sock_wait_destroy(&tcp->rcv.wait);
     sock_wait_destroy(&tcp->snd.wait);
+    if (tcp->parent)
+    {
+        list_remove(&tcp->parent->child_list, &tcp->child_node);
+        tcp->parent = (tcp_t *)0;
+    }
+    tcp_clear_parent(tcp);
+    tcp_unhash(tcp);
+    tcp_bind_put(tcp);
     tcp->state = TCP_STATE_FREE;
     list_remove(&tcp_list, &tcp->base.node);
     mblock_free(&tcp_mblock, tcp);
 }
 
-void tcp_clear_parent(tcp_t * tcp)
+void tcp_filter_ports(netif_filter_t * filter)
 {
-    node_t * node;
-    list_for_each(node, &tcp_list)
+    for (int i = 0; (i < TCP_HASH_SIZE) && !filter->all; i++)
     {
-        tcp_t * child = (tcp_t *) list_node_parent(node, sock_t, node);
-        if (child->parent == tcp)
+        node_t * node;
+        list_for_each(node, tcp_bind_hash + i)
         {
-            child->parent = (tcp_t *)0;
+            tcp_bind_t * bind = list_node_parent(node, tcp_bind_t, node);
+            netif_filter_add(filter, NET_PROTOCOL_TCP, bind->port);
         }
     }
 }
@@ -287,7 +547,14 @@ static net_err_t tcp_send(struct sock_t * s, const void * buf, size_t len, int f
     }
 
     int size = tcp_write_sndbuf(tcp, (uint8_t *)buf, (int)len);
-    if (size <= 0)
+    if (size < 0)
+    {
+        //send storage is shared by all connections, wait for one to give its back
+        tcp_sbuf_wait(tcp, 1);
+        *result_len = 0;
+        return NET_ERR_NEED_WAIT;
+    }
+    else if (size == 0)
     {
         *result_len = 0;
         return NET_ERR_NEED_WAIT;
@@ -332,6 +599,11 @@ static net_err_t tcp_recv(struct sock_t * s, void * buf, size_t len, int flags,
     }
     *result_len = 0;
     int cnt = tcp_buf_read_rcv(&tcp->rcv.buf, buf, (int)len);
+    if (tcp_buf_cnt(&tcp->rcv.buf) == 0)
+    {
+        //drained, idle connections hold no storage
+        tcp_detach_buf(tcp, &tcp->rcv.buf);
+    }
     if (cnt > 0)
     {
         *result_len = cnt;
@@ -447,27 +719,30 @@ static net_err_t tcp_bind(struct sock_t * s, const struct x_sockaddr * addr, x_s
         }
     }
 
+    uint16_t port = x_ntohs(addr_in->sin_port);
     node_t * node;
-    list_for_each(node, &tcp_list)
+    list_for_each(node, port_bucket(tcp_port_hash, port))
     {
-        sock_t * curr = (sock_t*) list_node_parent(node, sock_t , node);
-        if (curr == s)
-        {
-            continue;
-        }
-        if (curr->remote_port != NET_PORT_EMPTY)
-        {
-            continue;
-        }
-        if (ipaddr_is_equal(&curr->local_ip, &local_ip) && (curr->local_port == addr_in->sin_port))
+        sock_t * curr = (sock_t*) list_node_parent(node, tcp_t, port_node);
+        if (ipaddr_is_equal(&curr->local_ip, &local_ip) && (curr->local_port == port))
         {
+            if (curr->reuseport && s->reuseport)
+            {
+                continue;
+            }
+
             debug_error(DEBUG_TCP, "ipaddr and port already bound");
             return NET_ERR_PARAM;
         }
     }
 
     ipaddr_copy(&s->local_ip, &local_ip);
-    s->local_port = x_ntohs(addr_in->sin_port);
+    s->local_port = port;
+    if (tcp_rehash(tcp) < 0)
+    {
+        s->local_port = NET_PORT_EMPTY;
+        return NET_ERR_MEM;
+    }
     return NET_ERR_OK;
 }
 
@@ -487,24 +762,18 @@ static net_err_t tcp_listen(struct sock_t * s, int backlog)
 
 static net_err_t tcp_accept(struct sock_t * s, struct x_sockaddr * addr, x_socklen_t * len, struct sock_t ** client)
 {
+    tcp_t * listener = (tcp_t *)s;
     node_t * node;
-    list_for_each(node, &tcp_list)
+    list_for_each(node, &listener->child_list)
     {
-        sock_t * sock = list_node_parent(node, sock_t, node);
-        tcp_t * tcp = (tcp_t *) sock;
-
-        if (sock == s)
-        {
-            continue;
-        }
+        tcp_t * tcp = list_node_parent(node, tcp_t, child_node);
+        sock_t * sock = &tcp->base;
 
-        if (tcp->parent != (tcp_t *)s)
+        if (tcp->state == TCP_STATE_ESTABLISHED)
         {
-            continue;
-        }
+            list_remove(&listener->child_list, &tcp->child_node);
+            tcp->parent = (tcp_t *)0;
 
-        if (tcp->flags.inactive && (tcp->state == TCP_STATE_ESTABLISHED))
-        {
             struct x_sockaddr_in* addr_in = (struct x_sockaddr_in*) addr;
             plat_memset(addr_in, 0, *len);
             addr_in->sin_family = AF_INET;
@@ -554,6 +823,7 @@ static tcp_t * tcp_alloc(int wait, int family, int protocol)
     }
 
     plat_memset(tcp, 0, sizeof(tcp_t));
+    list_init(&tcp->child_list);
 
     net_err_t err = sock_init((sock_t*)tcp, family, protocol, &tcp_ops);
     if (err < 0)
@@ -568,6 +838,9 @@ static tcp_t * tcp_alloc(int wait, int family, int protocol)
     tcp->conn.keep_intvl = TCP_KEEPALIVE_INTVL;
     tcp->conn.keep_cnt = TCP_KEEPALIVE_PROBES;
 
+    //segments are sized to the path mtu
+    tcp->base.dst.df = 1;
+
     tcp->snd.ostate = TCP_OSTATE_IDLE;
     tcp->snd.rto = TCP_INIT_RTO;
     tcp->snd.rexmit_max = TCP_INIT_RETRIES;
@@ -631,31 +904,64 @@ sock_t * tcp_create(int family, int protocol)
     return (sock_t *)tcp;
 }
 
+/**
+ * listener on local_port that accepts connections to local_ip
+ * return 2 on exact ip, 1 on wildcard
+ */
+static int tcp_listen_match(sock_t * s, ipaddr_t * local_ip, uint16_t local_port)
+{
+    if ((((tcp_t *)s)->state != TCP_STATE_LISTEN) || (s->local_port != local_port))
+    {
+        return 0;
+    }
+
+    if (ipaddr_is_any(&s->local_ip))
+    {
+        return 1;
+    }
+    return ipaddr_is_equal(&s->local_ip, local_ip) ? 2 : 0;
+}
+
 tcp_t * tcp_find(ipaddr_t * local_ip, uint16_t local_port, ipaddr_t * remote_ip, uint16_t remote_port)
 {
     sock_t* match = (sock_t*)0;
+    int match_level = 0, match_cnt = 0;
 
     node_t* node;
-    list_for_each(node, &tcp_list) {
-        sock_t* s = list_node_parent(node, sock_t, node);
+    list_for_each(node, conn_bucket(local_port, remote_ip, remote_port)) {
+        sock_t* s = (sock_t*)list_node_parent(node, tcp_t, conn_node);
 
         if (ipaddr_is_equal(&s->local_ip, local_ip) && (s->local_port == local_port) &&
             ipaddr_is_equal(&s->remote_ip, remote_ip) && (s->remote_port == remote_port)) {
             return (tcp_t*)s;
         }
+    }
 
-        tcp_t * tcp = (tcp_t *)s;
-        if ((tcp->state == TCP_STATE_LISTEN) && (s->local_port == local_port)) {
-            if (!ipaddr_is_any(&s->local_ip) && !ipaddr_is_equal(&s->local_ip, local_ip)) {
-                continue;
-            }
-
-            if (s->local_port == local_port) {
-                match = s;
-            }
+    list_t * bucket = port_bucket(tcp_port_hash, local_port);
+    list_for_each(node, bucket) {
+        sock_t* s = (sock_t*)list_node_parent(node, tcp_t, port_node);
+        int level = tcp_listen_match(s, local_ip, local_port);
+        if (level > match_level) {
+            match = s;
+            match_level = level;
+            match_cnt = 1;
+        } else if (level && (level == match_level)) {
+            match_cnt++;
         }
     }
 
+    if ((match_cnt <= 1) || !match->reuseport) {
+        return (tcp_t*)match;
+    }
+
+    //reuseport group: spread new connections across the listeners by flow hash
+    int idx = (int)(flow_hash(remote_ip, remote_port, local_ip, local_port) % (uint32_t)match_cnt);
+    list_for_each(node, bucket) {
+        sock_t* s = (sock_t*)list_node_parent(node, tcp_t, port_node);
+        if ((tcp_listen_match(s, local_ip, local_port) == match_level) && (idx-- == 0)) {
+            return (tcp_t*)s;
+        }
+    }
     return (tcp_t*)match;
 }
 
@@ -685,6 +991,7 @@ void tcp_read_options(tcp_t * tcp, tcp_hdr_t * tcp_hdr)
                 if (opt->length == 4)
                 {
                     uint16_t mss = x_ntohs(opt->mss);
+                    tcp->mss_peer = mss;
                     if (mss < tcp->mss)
                     {
                         tcp->mss = mss;
@@ -775,18 +1082,7 @@ void tcp_kill_all_timers(tcp_t * tcp)
 
 int tcp_backlog_count(tcp_t * tcp)
 {
-    int count = 0;
-
-    node_t * node;
-    list_for_each(node, &tcp_list)
-    {
-        tcp_t * child = (tcp_t *)list_node_parent(node, sock_t, node);
-        if(child->parent == tcp && child->flags.inactive)
-        {
-            count++;
-        }
-    }
-    return count;
+    return list_count(&tcp->child_list);
 }
 
 tcp_t * tcp_create_child(tcp_t* tcp, tcp_seg_t * seg)
@@ -812,5 +1108,11 @@ tcp_t * tcp_create_child(tcp_t* tcp, tcp_seg_t * seg)
     tcp_read_options(child, seg->hdr);
 
     tcp_insert(child);
+    list_insert_last(&tcp->child_list, &child->child_node);
+    if (tcp_rehash(child) < 0)
+    {
+        tcp_free(child);
+        return (tcp_t *)0;
+    }
     return child;
 }
\ No newline at end of file
@@ -74,7 +74,7 @@ net_err_t tcp_in(pktbuf_t * buf, ipaddr_t * src_ip, ipaddr_t * dest_ip)
     }
     tcp_hdr = (tcp_hdr_t*) pktbuf_data(buf);
 
-    if (tcp_hdr->checksum)
+    if (tcp_hdr->checksum && !buf->csum_valid)
     {
         pktbuf_reset_access(buf);
         if (checksum_peso(buf, dest_ip, src_ip, NET_PROTOCOL_TCP))
@@ -124,6 +124,7 @@ net_err_t tcp_in(pktbuf_t * buf, ipaddr_t * src_ip, ipaddr_t * dest_ip)
     }
 
     tcp_keepalive_restart(tcp);
+    pktbuf_reset_access(buf);
     net_err_t err = pktbuf_seek(buf, tcp_hdr_size(tcp_hdr));
     if (err < 0)
     {
@@ -153,6 +154,11 @@ static int copy_data_to_rcvbuf(tcp_t * tcp, tcp_seg_t * seg) {
     int doffset = (int) (seg->seq - tcp->rcv.nxt);
     if (seg->data_len && doffset == 0)
     {
+        if (tcp_attach_buf(tcp, &tcp->rcv.buf) < 0)
+        {
+            //dropped, the peer sends it again
+            return -1;
+        }
         return tcp_buf_write_rcv(&tcp->rcv.buf, doffset, seg->buf, seg->data_len);
     }
     return 0;
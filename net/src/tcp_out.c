@@ -7,9 +7,27 @@
 #include "protocol.h"
 #include "ipv4.h"
 
-static net_err_t send_out(tcp_hdr_t * out, pktbuf_t * buf, ipaddr_t * dest, ipaddr_t * src)
+/**
+ * @param dst destination cache of the connection, null for replies without one
+ */
+static net_err_t send_out(tcp_hdr_t * out, pktbuf_t * buf, ipaddr_t * dest, ipaddr_t * src, ip_dst_t * dst)
 {
+    //without a connection cache, look the route up once for this segment only
+    ip_dst_t route;
+    if (!dst)
+    {
+        dst = &route;
+        dst->gen = 0;
+        dst->df = 0;
+    }
+    if (ipv4_dst_update(dst, dest) < 0)
+    {
+        debug_warn(DEBUG_TCP, "no route");
+        pktbuf_free(buf);
+        return NET_ERR_UNREACHABLE;
+    }
 
+    buf->flow_hash = flow_hash(src, out->sport, dest, out->dport);
     out->sport = x_htons(out->sport);
     out->dport = x_htons(out->dport);
     out->seq = x_htonl(out->seq);
@@ -17,9 +35,13 @@ static net_err_t send_out(tcp_hdr_t * out, pktbuf_t * buf, ipaddr_t * dest, ipad
     out->win = x_htons(out->win);
     out->urg_ptr = x_htons(out->urg_ptr);
     out->checksum = 0;
-    out->checksum = checksum_peso(buf, dest, src, NET_PROTOCOL_TCP);
+    //super-segments are checksummed per segment when gso cuts them
+    if (!buf->gso_size && !dst->local)
+    {
+        out->checksum = checksum_peso(buf, dest, src, NET_PROTOCOL_TCP);
+    }
     tcp_show_pkt("tcp out", out, buf);
-    net_err_t err = ipv4_out(NET_PROTOCOL_TCP, dest, src, buf);
+    net_err_t err = ipv4_out_dst(NET_PROTOCOL_TCP, dest, src, buf, dst);
     if (err < 0)
     {
         debug_warn(DEBUG_TCP, "send tcp reset failed: %d", err);
@@ -63,7 +85,7 @@ net_err_t tcp_send_reset(tcp_seg_t * seg)
 
     out->win = out->urg_ptr = 0;
 
-    return send_out(out, buf, &seg->remote_ip, &seg->local_ip);
+    return send_out(out, buf, &seg->remote_ip, &seg->local_ip, (ip_dst_t *)0);
 }
 
 /**
@@ -83,7 +105,14 @@ static void get_send_info(tcp_t * tcp, int rexmit, int * doff, int * dlen)
         *doff = (int) (tcp->snd.nxt - tcp->snd.una);
         *dlen = tcp_buf_cnt(&tcp->snd.buf) - *doff;
     }
-    *dlen = (*dlen > tcp->mss) ? tcp->mss : *dlen;
+    tcp_update_mss(tcp);
+    //more than mss goes out as one super-segment which gso cuts at netif_put_out
+    int max_len = tcp->flags.syn_out ? tcp->mss : TCP_GSO_MAX_SIZE;
+    if (max_len < tcp->mss)
+    {
+        max_len = tcp->mss;
+    }
+    *dlen = (*dlen > max_len) ? max_len : *dlen;
 }
 
 static int copy_send_data(tcp_t * tcp, pktbuf_t * buf, int doff, int dlen)
@@ -105,6 +134,11 @@ static int copy_send_data(tcp_t * tcp, pktbuf_t * buf, int doff, int dlen)
     pktbuf_seek(buf, hdr_size);
 
     tcp_buf_read_send(&tcp->snd.buf, doff, buf, dlen);
+    if (dlen > tcp->mss)
+    {
+        buf->gso_size = tcp->mss;
+        buf->gso_segs = (dlen + tcp->mss - 1) / tcp->mss;
+    }
     return dlen;
 }
 
@@ -184,7 +218,7 @@ net_err_t tcp_transmit(tcp_t * tcp)
     copy_send_data(tcp, buf, doff, dlen);
 
     tcp->snd.nxt += hdr->f_syn + hdr->f_fin + dlen;
-    return send_out(hdr, buf, &tcp->base.remote_ip, &tcp->base.local_ip);
+    return send_out(hdr, buf, &tcp->base.remote_ip, &tcp->base.local_ip, &tcp->base.dst);
 }
 
 net_err_t tcp_send_syn(tcp_t * tcp)
@@ -221,6 +255,11 @@ net_err_t tcp_ack_process(tcp_t * tcp, tcp_seg_t * seg)
         sock_wakeup(&tcp->base, SOCK_WAIT_WRITE, NET_ERR_OK);
         tcp->snd.una += curr_acked;
         curr_acked -= tcp_buf_remove(&tcp->snd.buf, curr_acked);
+        if (tcp_buf_cnt(&tcp->snd.buf) == 0)
+        {
+            //all acked, idle connections hold no storage
+            tcp_detach_buf(tcp, &tcp->snd.buf);
+        }
 
         if (tcp->flags.fin_out && curr_acked) {
             tcp->flags.fin_out = 0;
@@ -249,7 +288,7 @@ net_err_t tcp_send_ack(tcp_t * tcp, tcp_seg_t * seg)
     hdr->win = tcp_rcv_window(tcp);
     hdr->urg_ptr = 0;
     tcp_set_hdr_size(hdr, sizeof(tcp_hdr_t));
-    return send_out(hdr, buf, &tcp->base.remote_ip, &tcp->base.local_ip);
+    return send_out(hdr, buf, &tcp->base.remote_ip, &tcp->base.local_ip, &tcp->base.dst);
 }
 
 net_err_t tcp_send_fin(tcp_t * tcp)
@@ -267,6 +306,11 @@ int tcp_write_sndbuf(tcp_t* tcp, const uint8_t* buf, int len)
         return 0;
     }
 
+    if (tcp_attach_buf(tcp, &tcp->snd.buf) < 0)
+    {
+        return -1;
+    }
+
     int wr_len = (len > free_cnt) ? free_cnt : len;
     tcp_buf_write_send(&tcp->snd.buf, buf, wr_len);
     return wr_len;
@@ -294,7 +338,7 @@ net_err_t tcp_send_reset_for_tcp(tcp_t * tcp)
     out->urg_ptr = 0;
     tcp_set_hdr_size(out, sizeof(tcp_hdr_t));
 
-    return send_out(out, buf, &tcp->base.remote_ip, &tcp->base.local_ip);
+    return send_out(out, buf, &tcp->base.remote_ip, &tcp->base.local_ip, &tcp->base.dst);
 }
 
 net_err_t tcp_send_keepalive(tcp_t * tcp)
@@ -318,7 +362,7 @@ net_err_t tcp_send_keepalive(tcp_t * tcp)
     out->urg_ptr = 0;
     tcp_set_hdr_size(out, sizeof(tcp_hdr_t));
 
-    return send_out(out, buf, &tcp->base.remote_ip, &tcp->base.local_ip);
+    return send_out(out, buf, &tcp->base.remote_ip, &tcp->base.local_ip, &tcp->base.dst);
 }
 
 const char * tcp_ostate_name(tcp_t * tcp)
@@ -390,7 +434,7 @@ net_err_t tcp_retransmit(tcp_t * tcp)
 
     copy_send_data(tcp, buf, doff, dlen);
     tcp->snd.nxt = hdr->f_syn + hdr->f_fin + tcp->snd.una + dlen;
-    return send_out(hdr, buf, &tcp->base.remote_ip, &tcp->base.local_ip);
+    return send_out(hdr, buf, &tcp->base.remote_ip, &tcp->base.local_ip, &tcp->base.dst);
 }
 
 static void tcp_out_timer_tmo(struct net_timer_t * timer, void * arg)
@@ -488,7 +532,7 @@ static void tcp_ostate_sending_in(tcp_t * tcp, tcp_oevent_t event)
         case TCP_OEVENT_SEND:
             if ((tcp->snd.una == tcp->snd.nxt) || tcp->flags.fin_out)
             {
-                if (tcp_buf_cnt(&tcp->snd.buf) || tcp->flags.fin_in)
+                if (tcp_buf_cnt(&tcp->snd.buf) || tcp->flags.fin_out)
                 {
                     debug_info(DEBUG_TCP, "tcp_buf_cnt-----------1");
                     tcp_transmit(tcp);
@@ -513,7 +557,7 @@ static void tcp_ostate_resending_in(tcp_t * tcp, tcp_oevent_t event)
         case TCP_OEVENT_SEND:
             if ((tcp->snd.una == tcp->snd.nxt) || tcp->flags.fin_out)
             {
-                if (tcp_buf_cnt(&tcp->snd.buf) || tcp->flags.fin_in)
+                if (tcp_buf_cnt(&tcp->snd.buf) || tcp->flags.fin_out)
                 {
                     debug_info(DEBUG_TCP, "tcp_buf_cnt-----------2");
                     tcp_transmit(tcp);
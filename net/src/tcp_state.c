@@ -31,6 +31,10 @@ const char * tcp_state_name(tcp_state_t state)
 
 void tcp_set_state(tcp_t * tcp, tcp_state_t state)
 {
+    if ((tcp->state == TCP_STATE_TIME_WAIT) != (state == TCP_STATE_TIME_WAIT))
+    {
+        tcp_timewait_track(tcp, state == TCP_STATE_TIME_WAIT);
+    }
     tcp->state = state;
     tcp_show_info("tcp set state", tcp);
 }
@@ -205,6 +209,10 @@ static void tcp_time_wait(tcp_t * tcp)
     tcp_kill_all_timers(tcp);
     net_timer_add(&tcp->conn.keep_timer, "2msl timer", tcp_timewait_tmo, tcp, 2 * TCP_TMO_MSL, 0);
 
+    //nothing is read or sent from here on
+    tcp_detach_buf(tcp, &tcp->snd.buf);
+    tcp_detach_buf(tcp, &tcp->rcv.buf);
+
     sock_wakeup(&tcp->base, SOCK_WAIT_ALL, NET_ERR_CLOSE);
 }
 
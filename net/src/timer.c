@@ -6,19 +6,33 @@
 #include "debug.h"
 #include "sys_plat.h"
 
-static list_t timer_list;
+#define TIMER_TICK_MS       (1 << NET_TIMER_TICK_SHIFT)
+#define TIMER_SLOT(ms)      (timer_wheel + (((ms) >> NET_TIMER_TICK_SHIFT) & (NET_TIMER_WHEEL_SIZE - 1)))
+//a before b, wrap safe
+#define TIMER_BEFORE(a, b)  ((int32_t)((a) - (b)) < 0)
+
+//hashed timing wheel, a slot holds the timers expiring in its tick of every revolution
+static list_t timer_wheel[NET_TIMER_WHEEL_SIZE];
+//ms gone since init, advanced by net_timer_check_tmo
+static uint32_t timer_clock;
+static int timer_cnt;
+//no timer expires before this
+static uint32_t timer_next;
 
 #if DEBUG_DISP_ENABLED(DEBUG_TIMER)
 static void display_timer_list()
 {
     plat_printf("--------------- timer list ---------------\n");
-    node_t * node;
     int index = 0;
-    list_for_each(node, &timer_list)
+    for (int i = 0; i < NET_TIMER_WHEEL_SIZE; i++)
     {
-        net_timer_t * timer = list_node_parent(node, net_timer_t, node);
-        plat_printf("%d: %s, period: %d, curr: %dms, reload: %d ms \n", index++, timer->name,
-                    timer->flags & NET_TIMER_RELOAD ? 1 : 0, timer->curr, timer->reload);
+        node_t * node;
+        list_for_each(node, timer_wheel + i)
+        {
+            net_timer_t * timer = list_node_parent(node, net_timer_t, node);
+            plat_printf("%d: %s, period: %d, curr: %dms, reload: %d ms \n", index++, timer->name,
+                        timer->flags & NET_TIMER_RELOAD ? 1 : 0, (int)(timer->expire - timer_clock), timer->reload);
+        }
     }
 }
 #else
@@ -28,77 +42,88 @@ static void display_timer_list()
 net_err_t net_timer_init(void)
 {
     debug_info(DEBUG_TIMER, "timer init");
-    list_init(&timer_list);
+    for (int i = 0; i < NET_TIMER_WHEEL_SIZE; i++)
+    {
+        list_init(timer_wheel + i);
+    }
+    timer_clock = 0;
+    timer_cnt = 0;
+    timer_next = 0;
     return NET_ERR_OK;
 }
 
-static void insert_timer(net_timer_t * insert)
+static void insert_timer(net_timer_t * insert, int ms)
 {
-    node_t * node;
-    list_for_each(node, &timer_list)
+    insert->expire = timer_clock + ms;
+    insert->slot = TIMER_SLOT(insert->expire);
+    list_insert_last(insert->slot, &insert->node);
+
+    if (!timer_cnt++ || TIMER_BEFORE(insert->expire, timer_next))
     {
-        net_timer_t * curr = list_node_parent(node, net_timer_t, node);
-        if (insert->curr > curr->curr)
-        {
-            insert->curr -= curr->curr;
-        }
-        else if(insert->curr == curr->curr)
-        {
-            insert->curr = 0;
-            list_insert_after(&timer_list, node, &insert->node);
-            return;
-        }
-        else
+        timer_next = insert->expire;
+    }
+}
+
+/**
+ * find the earliest expiry from the slots ahead, looking one revolution at most
+ */
+static void update_next(void)
+{
+    uint32_t slot_end = (timer_clock & ~(uint32_t)(TIMER_TICK_MS - 1)) + TIMER_TICK_MS;
+    for (int i = 0; i < NET_TIMER_WHEEL_SIZE; i++, slot_end += TIMER_TICK_MS)
+    {
+        int found = 0;
+        node_t * node;
+        list_for_each(node, TIMER_SLOT(slot_end - TIMER_TICK_MS))
         {
-            curr->curr -= insert->curr;
-            node_t * pre = list_node_pre(&curr->node);
-            if (pre)
+            net_timer_t * timer = list_node_parent(node, net_timer_t, node);
+            if (!TIMER_BEFORE(timer->expire, slot_end))
             {
-                list_insert_after(&timer_list, pre, &insert->node);
+                //a later revolution
+                continue;
             }
-            else
+            if (!found++ || TIMER_BEFORE(timer->expire, timer_next))
             {
-                list_insert_first(&timer_list, &insert->node);
+                timer_next = timer->expire;
             }
+        }
+
+        if (found)
+        {
             return;
         }
     }
 
-    list_insert_last(&timer_list, &insert->node);
+    timer_next = slot_end - TIMER_TICK_MS;
 }
 
 net_err_t net_timer_add(net_timer_t * timer, const char * name, timer_proc_t proc, void * arg, int ms, int flags)
 {
-    plat_strncpy(timer->name, name, TIMER_NAME_SIZE);
-    timer->reload = timer->curr = ms;
+    if (timer->slot)
+    {
+        net_timer_remove(timer);
+    }
+
+    timer->name = name;
+    timer->reload = ms;
     timer->proc = proc;
     timer->arg = arg;
     timer->flags = flags;
-    insert_timer(timer);
+    insert_timer(timer, ms);
     display_timer_list();
     return NET_ERR_OK;
 }
 
 void net_timer_remove(net_timer_t * timer)
 {
-    node_t * node;
-    list_for_each(node, &timer_list)
+    if (!timer->slot)
     {
-        net_timer_t * curr = list_node_parent(node, net_timer_t, node);
-        if (curr != timer)
-        {
-            continue;
-        }
-        node_t * next = list_node_next(&timer->node);
-        if (next)
-        {
-            net_timer_t * next_timer = list_node_parent(next, net_timer_t, node);
-            next_timer->curr += timer->curr;
-        }
-        list_remove(&timer_list, &timer->node);
-        break;
+        return;
     }
 
+    list_remove(timer->slot, &timer->node);
+    timer->slot = (list_t *)0;
+    timer_cnt--;
     display_timer_list();
 }
 
@@ -107,47 +132,66 @@ net_err_t net_timer_check_tmo(int diff_ms)
     list_t wait_list;
     list_init(&wait_list);
 
-    node_t * node = list_first(&timer_list);
-    while (node)
+    //slots passed over since the last check, the one holding the old clock included
+    uint32_t ticks = ((timer_clock & (TIMER_TICK_MS - 1)) + (uint32_t)diff_ms) >> NET_TIMER_TICK_SHIFT;
+    if (ticks >= NET_TIMER_WHEEL_SIZE)
     {
-        node_t * next = list_node_next(node);
-        net_timer_t * timer = list_node_parent(node, net_timer_t , node);
-        if (timer->curr > diff_ms)
+        ticks = NET_TIMER_WHEEL_SIZE - 1;
+    }
+
+    uint32_t slot_ms = timer_clock;
+    timer_clock += diff_ms;
+    if (!timer_cnt || TIMER_BEFORE(timer_clock, timer_next))
+    {
+        return NET_ERR_OK;
+    }
+
+    for (uint32_t i = 0; i <= ticks; i++, slot_ms += TIMER_TICK_MS)
+    {
+        list_t * slot = TIMER_SLOT(slot_ms);
+        node_t * node = list_first(slot);
+        while (node)
         {
-            timer->curr -= diff_ms;
-            break;
+            node_t * next = list_node_next(node);
+            net_timer_t * timer = list_node_parent(node, net_timer_t , node);
+            if (!TIMER_BEFORE(timer_clock, timer->expire))
+            {
+                //still pending on wait_list, a callback may remove it before it runs
+                list_remove(slot, &timer->node);
+                list_insert_last(&wait_list, &timer->node);
+                timer->slot = &wait_list;
+            }
+            node = next;
         }
-        diff_ms -= timer->curr;
-        timer->curr = 0;
-        list_remove(&timer_list, &timer->node);
-        list_insert_last(&wait_list, &timer->node);
-
-        node = next;
     }
 
+    node_t * node;
     while ((node = list_remove_first(&wait_list)) != (node_t *) 0)
     {
         net_timer_t * timer = list_node_parent(node, net_timer_t , node);
-        if (timer)
+        timer->slot = (list_t *)0;
+        timer_cnt--;
+        timer->proc(timer, timer->arg);
+        if ((timer->flags & NET_TIMER_RELOAD) && !timer->slot)
         {
-            timer->proc(timer, timer->arg);
-            if (timer->flags & NET_TIMER_RELOAD)
-            {
-                timer->curr = timer->reload;
-                insert_timer(timer);
-            }
+            insert_timer(timer, timer->reload);
         }
     }
+
+    if (timer_cnt)
+    {
+        update_next();
+    }
     return NET_ERR_OK;
 }
 
 int net_timer_first_tmo(void)
 {
-    node_t * node = list_first(&timer_list);
-    if (node)
+    if (!timer_cnt)
     {
-        net_timer_t * timer = list_node_parent(node, net_timer_t , node);
-        return timer->curr;
+        return 0;
     }
-    return 0;
-}
\ No newline at end of file
+
+    int tmo = (int)(timer_next - timer_clock);
+    return tmo > 0 ? tmo : 1;
+}
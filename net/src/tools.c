@@ -53,7 +53,33 @@ uint16_t checksum16(int offset, void * buf, uint16_t len, uint32_t pre_sum, int
     return complement ? (uint16_t) ~checksum : (uint16_t) checksum;
 }
 
+uint16_t checksum16_update(uint16_t checksum, uint16_t old, uint16_t new_word)
+{
+    //HC' = ~(~HC + ~m + m')
+    uint32_t sum = (uint16_t)~checksum + (uint16_t)~old + (uint32_t)new_word;
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum += sum >> 16;
+    return (uint16_t)~sum;
+}
+
+uint32_t flow_hash(const ipaddr_t * ip1, uint16_t port1, const ipaddr_t * ip2, uint16_t port2)
+{
+    //xor first so that swapping the two ends gives the same hash
+    uint32_t h = (ip1->q_addr ^ ip2->q_addr) ^ ((uint32_t)(port1 ^ port2) * 0x9E3779B1u);
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
 uint16_t checksum_peso(pktbuf_t * buf, const ipaddr_t * dest, const ipaddr_t * src, uint8_t protocol)
+{
+    return checksum_peso_at(buf, 0, buf->total_size, dest, src, protocol);
+}
+
+uint16_t checksum_peso_at(pktbuf_t * buf, int start, int size, const ipaddr_t * dest, const ipaddr_t * src, uint8_t protocol)
 {
     uint8_t zero_protocol[2] = {0, protocol};
     int offset = 0;
@@ -66,10 +92,11 @@ uint16_t checksum_peso(pktbuf_t * buf, const ipaddr_t * dest, const ipaddr_t * s
     sum = checksum16(offset, (void *)zero_protocol, 2, sum, 0);
     offset += 2;
 
-    uint16_t len = x_htons(buf->total_size);
+    uint16_t len = x_htons(size);
     sum = checksum16(offset, &len, 2, sum, 0);
 
     pktbuf_reset_access(buf);
-    sum = pktbuf_checksum16(buf, buf->total_size, (int)sum, 1);
+    pktbuf_seek(buf, start);
+    sum = pktbuf_checksum16(buf, size, (int)sum, 1);
     return sum;
 }
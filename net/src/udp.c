@@ -13,7 +13,11 @@
 
 static udp_t udp_tbl[UDP_MAX_NR];
 static mblock_t udp_mblock;
-static list_t udp_list;
+//every socket with a local port, by port
+static list_t udp_port_hash[UDP_HASH_SIZE];
+//connected sockets, by local port and remote address, searched first
+static list_t udp_conn_hash[UDP_HASH_SIZE];
+static int udp_conn_cnt;
 
 #if DEBUG_DISP_ENABLED(DEBUG_UDP)
 static void display_udp_packet(udp_pkt_t * pkt)
@@ -32,15 +36,18 @@ static void display_udp_list(void)
     node_t * node;
     int idx = 0;
 
-    list_for_each(node, &udp_list)
+    for (int i = 0; i < UDP_HASH_SIZE; i++)
     {
-        udp_t * udp = (udp_t *) list_node_parent(node, sock_t, node);
-        plat_printf("[%d]:", idx++);
-        debug_dump_ip("     local: ", &udp->base.local_ip);
-        plat_printf("     local port: %d", udp->base.local_port);
-        debug_dump_ip("     remote: ", &udp->base.remote_ip);
-        plat_printf("     remote port: %d", udp->base.remote_port);
-        plat_printf("\n");
+        list_for_each(node, &udp_port_hash[i])
+        {
+            udp_t * udp = (udp_t *) list_node_parent(node, sock_t, node);
+            plat_printf("[%d]:", idx++);
+            debug_dump_ip("     local: ", &udp->base.local_ip);
+            plat_printf("     local port: %d", udp->base.local_port);
+            debug_dump_ip("     remote: ", &udp->base.remote_ip);
+            plat_printf("     remote port: %d", udp->base.remote_port);
+            plat_printf("\n");
+        }
     }
 }
 #else
@@ -51,15 +58,88 @@ static void display_udp_list(void)
 net_err_t udp_init()
 {
     debug_info(DEBUG_UDP, "udp init");
-    list_init(&udp_list);
+    for (int i = 0; i < UDP_HASH_SIZE; i++)
+    {
+        list_init(&udp_port_hash[i]);
+        list_init(&udp_conn_hash[i]);
+    }
+    udp_conn_cnt = 0;
     mblock_init(&udp_mblock, udp_tbl, sizeof(udp_t), UDP_MAX_NR, LOCKER_NONE);
     return NET_ERR_OK;
 }
 
+static list_t * port_bucket(uint16_t port)
+{
+    return udp_port_hash + (port % UDP_HASH_SIZE);
+}
+
+static list_t * conn_bucket(uint16_t local_port, ipaddr_t * remote_ip, uint16_t remote_port)
+{
+    uint32_t hash = remote_ip->q_addr ^ (((uint32_t)remote_port << 16) | local_port);
+    hash *= 0x9E3779B1;
+    return udp_conn_hash + ((hash >> 16) % UDP_HASH_SIZE);
+}
+
+static void udp_unhash(udp_t * udp)
+{
+    if (udp->port_bucket)
+    {
+        list_remove(udp->port_bucket, &udp->base.node);
+        udp->port_bucket = (list_t *)0;
+    }
+    if (udp->conn_bucket)
+    {
+        list_remove(udp->conn_bucket, &udp->conn_node);
+        udp->conn_bucket = (list_t *)0;
+        udp_conn_cnt--;
+    }
+}
+
+/**
+ * file udp under its current addresses, called whenever they change
+ */
+static void udp_rehash(udp_t * udp)
+{
+    sock_t * s = &udp->base;
+    udp_unhash(udp);
+    if (!s->local_port)
+    {
+        return;
+    }
+
+    udp->port_bucket = port_bucket(s->local_port);
+    list_insert_last(udp->port_bucket, &s->node);
+    if (s->remote_port && !ipaddr_is_any(&s->remote_ip))
+    {
+        udp->conn_bucket = conn_bucket(s->local_port, &s->remote_ip, s->remote_port);
+        list_insert_last(udp->conn_bucket, &udp->conn_node);
+        udp_conn_cnt++;
+    }
+    sock_filter_update();
+}
+
+void udp_filter_ports(netif_filter_t * filter)
+{
+    for (int i = 0; (i < UDP_HASH_SIZE) && !filter->all; i++)
+    {
+        node_t * node;
+        list_for_each(node, udp_port_hash + i)
+        {
+            sock_t * s = list_node_parent(node, sock_t, node);
+            netif_filter_add(filter, NET_PROTOCOL_UDP, s->local_port);
+        }
+    }
+}
+
 static net_err_t udp_close(sock_t * sock)
 {
     udp_t * udp = (udp_t *) sock;
-    list_remove(&udp_list, &sock->node);
+    int bound = udp->port_bucket != (list_t *)0;
+    udp_unhash(udp);
+    if (bound)
+    {
+        sock_filter_update();
+    }
     node_t * node;
     while ((node= list_remove_first(&udp->recv_list)))
     {
@@ -76,7 +156,7 @@ static net_err_t udp_close(sock_t * sock)
 static int is_port_used(int port)
 {
     node_t * node;
-    list_for_each(node, &udp_list)
+    list_for_each(node, port_bucket(port))
     {
         sock_t * sock = (sock_t *) list_node_parent(node, sock_t, node);
         if (sock->local_port == port)
@@ -95,6 +175,10 @@ static net_err_t alloc_port(sock_t * sock)
     for (int i = NET_PORT_DYN_START; i < NET_PORT_DYN_END; ++i)
     {
         int port = search_index++;
+        if (search_index >= NET_PORT_DYN_END)
+        {
+            search_index = NET_PORT_DYN_START;
+        }
         if (!is_port_used(port))
         {
             sock->local_port = port;
@@ -105,6 +189,51 @@ static net_err_t alloc_port(sock_t * sock)
     return NET_ERR_NONE;
 }
 
+/**
+ * send buf as a train of gso_size datagrams, the route and link header are resolved once
+ */
+static net_err_t udp_gso_out(udp_t * udp, ipaddr_t * dest, uint16_t dport, pktbuf_t * buf)
+{
+    sock_t * s = &udp->base;
+    if (ipv4_dst_update(&s->dst, dest) < 0)
+    {
+        debug_error(DEBUG_UDP, "no route");
+        return NET_ERR_UNREACHABLE;
+    }
+
+    if (s->dst.mtu && ((int)(sizeof(ipv4_hdr_t) + sizeof(udp_hdr_t)) + udp->gso_size > s->dst.mtu))
+    {
+        debug_error(DEBUG_UDP, "segment size exceeds mtu");
+        return NET_ERR_SIZE;
+    }
+
+    //local delivery skips the netif where gso cuts, so split here
+    if (s->dst.local)
+    {
+        while (buf->total_size > udp->gso_size)
+        {
+            pktbuf_t * seg = pktbuf_split(buf, udp->gso_size);
+            if (!seg)
+            {
+                debug_error(DEBUG_UDP, "no buffer");
+                return NET_ERR_MEM;
+            }
+
+            net_err_t err = udp_out(dest, dport, &s->local_ip, s->local_port, seg, &s->dst);
+            if (err < 0)
+            {
+                pktbuf_free(seg);
+                return err;
+            }
+        }
+        return udp_out(dest, dport, &s->local_ip, s->local_port, buf, &s->dst);
+    }
+
+    buf->gso_size = udp->gso_size;
+    buf->gso_segs = (buf->total_size + udp->gso_size - 1) / udp->gso_size;
+    return udp_out(dest, dport, &s->local_ip, s->local_port, buf, &s->dst);
+}
+
 net_err_t udp_sendto(struct sock_t * s, const void * buf, size_t len, int flags,
                             const struct x_sockaddr * dest, x_socklen_t dest_len, ssize_t * result_len)
 {
@@ -124,10 +253,22 @@ net_err_t udp_sendto(struct sock_t * s, const void * buf, size_t len, int flags,
         return NET_ERR_PARAM;
     }
 
-    if (!s->local_port && ((s->err = alloc_port(s)) < 0))
+    if (!s->local_port)
     {
-        debug_error(DEBUG_UDP, "no port available");
-        return NET_ERR_NONE;
+        if ((s->err = alloc_port(s)) < 0)
+        {
+            debug_error(DEBUG_UDP, "no port available");
+            return NET_ERR_NONE;
+        }
+        udp_rehash((udp_t *)s);
+    }
+
+    udp_t * udp = (udp_t *)s;
+    int gso = udp->gso_size && (len > (size_t)udp->gso_size);
+    if (gso && ((len > UDP_GSO_MAX_SIZE) || (((int)len + udp->gso_size - 1) / udp->gso_size > UDP_GSO_MAX_SEGS)))
+    {
+        debug_error(DEBUG_UDP, "gso send too large");
+        return NET_ERR_SIZE;
     }
 
     pktbuf_t * pkt_buf = pktbuf_alloc((int)len);
@@ -143,7 +284,14 @@ net_err_t udp_sendto(struct sock_t * s, const void * buf, size_t len, int flags,
         goto end_send_to;
     }
 
-    err = udp_out(&dest_ip, dport, &s->local_ip, s->local_port, pkt_buf);
+    if (gso)
+    {
+        err = udp_gso_out(udp, &dest_ip, dport, pkt_buf);
+    }
+    else
+    {
+        err = udp_out(&dest_ip, dport, &s->local_ip, s->local_port, pkt_buf, &s->dst);
+    }
     if (err < 0)
     {
         debug_error(DEBUG_UDP, "send error");
@@ -159,19 +307,15 @@ net_err_t udp_sendto(struct sock_t * s, const void * buf, size_t len, int flags,
     return err;
 }
 
-net_err_t udp_recvfrom(struct sock_t * s, void * buf, size_t len, int flags,
-                              const struct x_sockaddr * src, x_socklen_t * src_len, ssize_t * result_len)
+/**
+ * take the first received datagram, its udp_from_t prefix goes to src
+ */
+static pktbuf_t * udp_take(udp_t * udp, const struct x_sockaddr * src)
 {
-    udp_t * udp = (udp_t*)s;
-
     node_t * first = list_remove_first(&udp->recv_list);
     if (!first)
     {
-        if (result_len)
-        {
-            *result_len = 0;
-        }
-        return NET_ERR_NEED_WAIT;
+        return (pktbuf_t *)0;
     }
     pktbuf_t * pktbuf = list_node_parent(first, pktbuf_t, node);
     udp_from_t * from = (udp_from_t *) pktbuf_data(pktbuf);
@@ -182,9 +326,26 @@ net_err_t udp_recvfrom(struct sock_t * s, void * buf, size_t len, int flags,
     addr->sin_port = x_htons(from->port);
     ipaddr_to_buf(&from->from, addr->sin_addr.addr_array);
     pktbuf_remove_header(pktbuf, sizeof(udp_from_t));
+    pktbuf_reset_access(pktbuf);
+    return pktbuf;
+}
+
+net_err_t udp_recvfrom(struct sock_t * s, void * buf, size_t len, int flags,
+                              const struct x_sockaddr * src, x_socklen_t * src_len, ssize_t * result_len)
+{
+    udp_t * udp = (udp_t*)s;
+
+    pktbuf_t * pktbuf = udp_take(udp, src);
+    if (!pktbuf)
+    {
+        if (result_len)
+        {
+            *result_len = 0;
+        }
+        return NET_ERR_NEED_WAIT;
+    }
 
     int size = (pktbuf->total_size > (int)len) ? (int)len : pktbuf->total_size;
-    pktbuf_reset_access(pktbuf);
     net_err_t err = pktbuf_read(pktbuf, buf, size);
     if (err < 0)
     {
@@ -201,11 +362,29 @@ net_err_t udp_recvfrom(struct sock_t * s, void * buf, size_t len, int flags,
     return NET_ERR_OK;
 }
 
+static net_err_t udp_recvbuf(struct sock_t * s, pktbuf_t ** buf, int flags,
+                             struct x_sockaddr * src, x_socklen_t * src_len)
+{
+    *buf = udp_take((udp_t *)s, src);
+    return *buf ? NET_ERR_OK : NET_ERR_NEED_WAIT;
+}
+
 static net_err_t udp_connect(struct sock_t * s, const struct x_sockaddr * addr, x_socklen_t len)
 {
     net_err_t err = sock_connect(s, addr, len);
+    if (err < 0)
+    {
+        return err;
+    }
+    //bind a port now so replies find the socket before the first send
+    if (!s->local_port && ((err = alloc_port(s)) < 0))
+    {
+        debug_error(DEBUG_UDP, "no port available");
+        return err;
+    }
+    udp_rehash((udp_t *)s);
     display_udp_list();
-    return err;
+    return NET_ERR_OK;
 }
 
 static net_err_t udp_bind(struct sock_t * s, const struct x_sockaddr * addr, x_socklen_t len)
@@ -222,41 +401,68 @@ static net_err_t udp_bind(struct sock_t * s, const struct x_sockaddr * addr, x_s
     ipaddr_from_buf(&local_ip, addr_in->sin_addr.addr_array);
 
     node_t * node;
-    udp_t * udp = (udp_t*)0;
-    list_for_each(node, &udp_list)
+    list_for_each(node, port_bucket(port))
     {
-        udp_t * u = (udp_t *) list_node_parent(node, sock_t , node);
-        if ((sock_t*)u == s)
+        sock_t * u = list_node_parent(node, sock_t , node);
+        if (((int)u->local_port == port) && (ipaddr_is_equal(&u->local_ip, &local_ip)))
         {
-            continue;
-        }
+            if (u->reuseport && s->reuseport)
+            {
+                continue;
+            }
 
-        if (((int)s->local_port == port) && (ipaddr_is_equal(&s->local_ip, &local_ip)))
-        {
-            udp = u;
-            break;
+            debug_error(DEBUG_UDP, "port already bound");
+            return NET_ERR_BOUND;
         }
     }
 
-    if (udp)
-    {
-        debug_error(DEBUG_UDP, "port already bound");
-        return NET_ERR_BOUND;
-    } else
+    net_err_t err = sock_bind(s, addr, len);
+    if (err < 0)
     {
-        sock_bind(s, addr, len);
+        return err;
     }
+    udp_rehash((udp_t *)s);
     display_udp_list();
     return NET_ERR_OK;
 }
 
+static net_err_t udp_setopt(struct sock_t * s, int level, int optname, const char * optval, int optlen)
+{
+    if (level != SOL_UDP)
+    {
+        return sock_setopt(s, level, optname, optval, optlen);
+    }
+
+    if (optname != UDP_SEGMENT)
+    {
+        debug_error(DEBUG_UDP, "unknown param");
+        return NET_ERR_PARAM;
+    }
+
+    if (optlen != sizeof(int))
+    {
+        debug_error(DEBUG_UDP, "param size error");
+        return NET_ERR_PARAM;
+    }
+
+    int size = *(const int *)optval;
+    if ((size < 0) || (size > (int)(NETIF_MTU_MAX - sizeof(ipv4_hdr_t) - sizeof(udp_hdr_t))))
+    {
+        debug_error(DEBUG_UDP, "segment size error");
+        return NET_ERR_PARAM;
+    }
+    ((udp_t *)s)->gso_size = size;
+    return NET_ERR_OK;
+}
+
 sock_t * udp_create(int family, int protocol)
 {
     static const sock_ops_t udp_ops = {
-            .setopt = sock_setopt,
+            .setopt = udp_setopt,
             .send = sock_send,
             .sendto = udp_sendto,
             .recvfrom = udp_recvfrom,
+            .recvbuf = udp_recvbuf,
             .recv = sock_recv,
             .close = udp_close,
             .connect = udp_connect,
@@ -277,6 +483,9 @@ sock_t * udp_create(int family, int protocol)
         return (sock_t *)0;
     }
     list_init(&udp->recv_list);
+    udp->port_bucket = udp->conn_bucket = (list_t *)0;
+    node_init(&udp->conn_node);
+    udp->gso_size = 0;
 
     udp->base.rcv_wait = &udp->rcv_wait;
     if (sock_wait_init(udp->base.rcv_wait))
@@ -284,7 +493,6 @@ sock_t * udp_create(int family, int protocol)
         debug_error(DEBUG_UDP, "create rcv wait failed");
         goto create_failed;
     }
-    list_insert_last(&udp_list, &udp->base.node);
     return (sock_t*)udp;
 
     create_failed:
@@ -292,18 +500,25 @@ sock_t * udp_create(int family, int protocol)
     return (sock_t*)0;
 }
 
-net_err_t udp_out(ipaddr_t * dest, uint16_t dport, ipaddr_t * src, uint16_t sport, pktbuf_t * buf)
+net_err_t udp_out(ipaddr_t * dest, uint16_t dport, ipaddr_t * src, uint16_t sport, pktbuf_t * buf, ip_dst_t * dst)
 {
-    if (ipaddr_is_any(src))
+    //without a socket cache, look the route up once for this datagram only
+    ip_dst_t route;
+    if (!dst)
     {
-        rentry_t * rt = rt_find(dest);
-        if (rt == (rentry_t *)0)
-        {
-            debug_error(DEBUG_UDP, "no route");
-            return NET_ERR_UNREACHABLE;
-        }
+        dst = &route;
+        dst->gen = 0;
+        dst->df = 0;
+    }
+    if (ipv4_dst_update(dst, dest) < 0)
+    {
+        debug_error(DEBUG_UDP, "no route");
+        return NET_ERR_UNREACHABLE;
+    }
 
-        src = &rt->netif->ipaddr;
+    if (ipaddr_is_any(src))
+    {
+        src = &dst->netif->ipaddr;
     }
 
     net_err_t err = pktbuf_add_header(buf, sizeof(udp_hdr_t), 1);
@@ -313,14 +528,19 @@ net_err_t udp_out(ipaddr_t * dest, uint16_t dport, ipaddr_t * src, uint16_t spor
         return NET_ERR_SIZE;
     }
 
+    buf->flow_hash = flow_hash(src, sport, dest, dport);
     udp_hdr_t * udp_hdr = (udp_hdr_t *) pktbuf_data(buf);
     udp_hdr->src_port = x_htons(sport);
     udp_hdr->dest_port = x_htons(dport);
     udp_hdr->total_len = x_htons(buf->total_size);
     udp_hdr->checksum = 0;
-    udp_hdr->checksum = checksum_peso(buf, dest, src, NET_PROTOCOL_UDP);
+    //super-datagrams are checksummed per datagram when gso cuts them
+    if (!buf->gso_size && !dst->local)
+    {
+        udp_hdr->checksum = checksum_peso(buf, dest, src, NET_PROTOCOL_UDP);
+    }
 
-    err = ipv4_out(NET_PROTOCOL_UDP, dest, src, buf);
+    err = ipv4_out_dst(NET_PROTOCOL_UDP, dest, src, buf, dst);
     if (err < 0)
     {
         debug_error(DEBUG_UDP, "udp out err");
@@ -330,7 +550,30 @@ net_err_t udp_out(ipaddr_t * dest, uint16_t dport, ipaddr_t * src, uint16_t spor
 }
 
 /**
- * find suitable udp
+ * unconnected socket on dport accepting datagrams from src_ip:sport
+ */
+static int udp_match(sock_t * s, ipaddr_t * src_ip, uint16_t sport, ipaddr_t * dest_ip, uint16_t dport)
+{
+    if ((s->local_port != dport) || ((udp_t *)s)->conn_bucket)
+    {
+        return 0;
+    }
+
+    if (!ipaddr_is_any(&s->remote_ip) && !ipaddr_is_equal(src_ip, &s->remote_ip))
+    {
+        return 0;
+    }
+
+    if (s->remote_port && (s->remote_port != sport))
+    {
+        return 0;
+    }
+
+    return ipaddr_is_equal(dest_ip, &s->local_ip) || ipaddr_is_any(&s->local_ip);
+}
+
+/**
+ * find suitable udp: a socket connected to the sender first, then one bound to dest_ip, then a wildcard one
  */
 static udp_t * udp_find(ipaddr_t * src_ip, uint16_t sport, ipaddr_t * dest_ip, uint16_t dport)
 {
@@ -340,32 +583,73 @@ static udp_t * udp_find(ipaddr_t * src_ip, uint16_t sport, ipaddr_t * dest_ip, u
     }
 
     node_t * node;
-    list_for_each(node, &udp_list)
+    if (udp_conn_cnt)
+    {
+        list_for_each(node, conn_bucket(dport, src_ip, sport))
+        {
+            udp_t * udp = list_node_parent(node, udp_t, conn_node);
+            sock_t * s = &udp->base;
+            if ((s->local_port == dport) && (s->remote_port == sport) && ipaddr_is_equal(src_ip, &s->remote_ip)
+                && (ipaddr_is_any(&s->local_ip) || ipaddr_is_equal(dest_ip, &s->local_ip)))
+            {
+                return udp;
+            }
+        }
+    }
+
+    udp_t * exact = (udp_t *)0, * wildcard = (udp_t *)0;
+    int exact_cnt = 0, wildcard_cnt = 0;
+    list_for_each(node, port_bucket(dport))
     {
         sock_t * s = list_node_parent(node, sock_t, node);
-        if (s->local_port != dport)
+        if (!udp_match(s, src_ip, sport, dest_ip, dport))
         {
             continue;
         }
 
-        if (!ipaddr_is_any(&s->local_ip) && !ipaddr_is_equal(dest_ip, &s->local_ip))
+        if (ipaddr_is_equal(dest_ip, &s->local_ip))
         {
-            continue;
+            if (!exact)
+            {
+                exact = (udp_t *)s;
+            }
+            exact_cnt++;
+        }
+        else
+        {
+            if (!wildcard)
+            {
+                wildcard = (udp_t *)s;
+            }
+            wildcard_cnt++;
         }
+    }
 
-        if (!ipaddr_is_any(&s->remote_ip) && !ipaddr_is_equal(src_ip, &s->remote_ip))
+    udp_t * first = exact ? exact : wildcard;
+    int cnt = exact ? exact_cnt : wildcard_cnt;
+    if ((cnt <= 1) || !first->base.reuseport)
+    {
+        return first;
+    }
+
+    //reuseport group: the same flow always lands on the same member
+    int idx = (int)(flow_hash(src_ip, sport, dest_ip, dport) % (uint32_t)cnt);
+    int want_exact = (first == exact);
+    list_for_each(node, port_bucket(dport))
+    {
+        sock_t * s = list_node_parent(node, sock_t, node);
+        if (!udp_match(s, src_ip, sport, dest_ip, dport)
+            || (ipaddr_is_equal(dest_ip, &s->local_ip) != want_exact))
         {
             continue;
         }
 
-        if (s->remote_port && (s->remote_port != sport))
+        if (idx-- == 0)
         {
-            continue;
+            return (udp_t *)s;
         }
-        return (udp_t *)s;
     }
-
-    return (udp_t *)0;
+    return first;
 }
 
 static net_err_t is_pkt_ok(udp_pkt_t * pkt, int size)
@@ -404,7 +688,7 @@ net_err_t udp_in(pktbuf_t * buf, ipaddr_t * src_ip, ipaddr_t * dest_ip)
 
     pktbuf_remove_header(buf, iphdr_size);
     udp_pkt = (udp_pkt_t *) pktbuf_data(buf);
-    if (udp_pkt->hdr.checksum)
+    if (udp_pkt->hdr.checksum && !buf->csum_valid)
     {
         pktbuf_reset_access(buf);
         if (checksum_peso(buf, dest_ip, src_ip, NET_PROTOCOL_UDP))
@@ -5,37 +5,156 @@
 #include "sys_plat.h"
 #include "ether.h"
 
+#define PCAP_STOP_TMO           100
+#define PCAP_STOP_RETRY         10
+#define PCAP_TX_BUF_SIZE        (64 * 1024)
+#define PCAP_FILTER_SIZE        (256 + NETIF_FILTER_PORTS * 2 * 24)
+
+//driver state behind netif->ops_data
+typedef struct pcap_dev_t
+{
+    netif_t * netif;
+    pcap_data_t data;
+    //capture handle, only the recv thread swaps it
+    pcap_t * rx;
+    //inject handle, captures nothing
+    pcap_t * tx;
+    int stop;
+    sys_sem_t rx_done;
+    sys_sem_t tx_done;
+
+    //guards rx swaps and the pending filter and rcv cfg, both are applied by the recv thread
+    sys_mutex_t locker;
+    char filter[PCAP_FILTER_SIZE];
+    int filter_dirty;
+    netif_rcv_cfg_t cfg;
+    int cfg_dirty;
+
+    //notified for each frame queued for sending
+    sys_sem_t tx_sem;
+    uint8_t tx_frame[NETIF_MTU_MAX + 6 + 6 + 2];
+
+    //frames copied out of the capture buffer by one pcap_dispatch
+    int cnt;
+    int sizes[NETIF_INQ_SIZE];
+    pktbuf_t * bufs[NETIF_INQ_SIZE];
+    uint8_t frames[NETIF_INQ_SIZE][NETIF_MTU_MAX + 6 + 6 + 2];
+} pcap_dev_t;
+
+//stage one captured frame, the capture buffer is reused once the handler returns
+static void recv_handler(u_char * user, const struct pcap_pkthdr * pkthdr, const u_char * pkt_data)
+{
+    pcap_dev_t * dev = (pcap_dev_t *) user;
+    int size = (int) pkthdr->caplen;
+    if (size > (int) sizeof(dev->frames[0]))
+    {
+        debug_warn(DEBUG_NETIF, "frame too large: %d\n", size);
+        return;
+    }
+
+    plat_memcpy(dev->frames[dev->cnt], pkt_data, size);
+    dev->sizes[dev->cnt++] = size;
+}
+
+/**
+ * apply the posted rcv cfg and filter, run by the recv thread between pcap_dispatch calls
+ * so the capture handle is never changed under it
+ */
+static void recv_apply(pcap_dev_t * dev)
+{
+    sys_mutex_lock(dev->locker);
+    netif_rcv_cfg_t cfg = dev->cfg;
+    int cfg_dirty = dev->cfg_dirty;
+    dev->cfg_dirty = 0;
+    sys_mutex_unlock(dev->locker);
+
+    //the old handle serves until the new one is ready
+    pcap_t * pcap = (pcap_t *)0;
+    if (cfg_dirty)
+    {
+        pcap = pcap_device_open(dev->data.ip, dev->data.hwaddr, cfg.buf_size, cfg.immediate, NETIF_RCV_TMO);
+        if (pcap == (pcap_t *)0)
+        {
+            debug_error(DEBUG_NETIF, "pcap reopen failed, name: %s\n", dev->netif->name);
+        }
+    }
+
+    sys_mutex_lock(dev->locker);
+    if (pcap)
+    {
+        pcap_close(dev->rx);
+        dev->rx = pcap;
+        dev->filter_dirty = 1;
+    }
+    if (dev->filter_dirty && dev->filter[0] && (pcap_device_set_filter(dev->rx, dev->filter) < 0))
+    {
+        debug_error(DEBUG_NETIF, "pcap set filter failed, name: %s\n", dev->netif->name);
+    }
+    dev->filter_dirty = 0;
+    sys_mutex_unlock(dev->locker);
+}
+
 //data packet recv thread
 void recv_thread (void * arg)
 {
     debug_info(DEBUG_NETIF, "recv thread is running!\n");
-    netif_t * netif = (netif_t *) arg;
-    pcap_t * pcap = (pcap_t *) netif->ops_data;
-    while (1)
+    pcap_dev_t * dev = (pcap_dev_t *) arg;
+    netif_t * netif = dev->netif;
+    while (!dev->stop)
     {
-        struct pcap_pkthdr * pkthdr;
-        const uint8_t * pkt_data;
-        //catch data packet
-        if (pcap_next_ex(pcap, &pkthdr, &pkt_data) != 1)
+        recv_apply(dev);
+
+        //drain up to a burst of frames per wakeup, then hand them over in one go
+        dev->cnt = 0;
+        if ((pcap_dispatch(dev->rx, netif->rcv_cfg.burst, recv_handler, (u_char *) dev) <= 0) || !dev->cnt)
         {
             continue;
         }
-        pktbuf_t * buf = pktbuf_alloc(pkthdr->len);
-        if (buf == (pktbuf_t *)0)
+
+        int n = pktbuf_alloc_burst(dev->bufs, dev->sizes, dev->cnt);
+        if (n < dev->cnt)
         {
-            debug_warn(DEBUG_NETIF, "buf == NULL");
-            continue;
+            debug_warn(DEBUG_NETIF, "no buf, %d frames dropped", dev->cnt - n);
+        }
+        for (int i = 0; i < n; i++)
+        {
+            pktbuf_write(dev->bufs[i], dev->frames[i], dev->sizes[i]);
         }
 
-        pktbuf_write(buf, pkt_data, pkthdr->len);
+        netif_put_in_steer(netif, dev->bufs, n);
+    }
+    sys_sem_notify(dev->rx_done);
+}
 
-        if (netif_put_in(netif, buf, 0) < 0)
+//send everything queued on all out_q
+static int xmit_drain(pcap_dev_t * dev)
+{
+    netif_t * netif = dev->netif;
+    int cnt = 0;
+    for (int qid = 0; qid < netif->queue_cnt; qid++)
+    {
+        pktbuf_t * buf;
+        while ((buf = netif_get_out_queue(netif, qid, -1)))
         {
-            debug_warn(DEBUG_NETIF, "netif %s in_q full\n", netif->name);
+            cnt++;
+            int total_size = buf->total_size;
+            if (total_size > (int) sizeof(dev->tx_frame))
+            {
+                debug_warn(DEBUG_NETIF, "frame too large: %d\n", total_size);
+                pktbuf_free(buf);
+                continue;
+            }
+            //short frames were padded by ether_out, no need to clear the buffer
+            pktbuf_read(buf, dev->tx_frame, total_size);
             pktbuf_free(buf);
-            continue;
+            //send net data packet to dest
+            if (pcap_inject(dev->tx, dev->tx_frame, total_size) == -1)
+            {
+                debug_error(DEBUG_NETIF, "pcap send failed, size:%d err:%s\n", total_size, pcap_geterr(dev->tx));
+            }
         }
     }
+    return cnt;
 }
 
 //data packet xmit thread
@@ -43,56 +162,197 @@ void xmit_thread (void * arg)
 {
     debug_info(DEBUG_NETIF, "xmit thread is running!\n");
 
-    netif_t * netif = (netif_t *) arg;
-    pcap_t * pcap = (pcap_t *) netif->ops_data;
-
-    static uint8_t rw_buffer[1500 + 6 + 6 + 2];
-    while (1)
+    pcap_dev_t * dev = (pcap_dev_t *) arg;
+    netif_t * netif = dev->netif;
+    while (!dev->stop)
     {
-        pktbuf_t * buf = netif_get_out(netif, 0);
-        if (buf == (pktbuf_t *)0)
+        if (xmit_drain(dev))
+        {
+            continue;
+        }
+
+        //spin a while before sleeping if busy poll is on
+        int budget = netif->out_poll.budget;
+        uint32_t start = sys_time_us();
+        int pending = netif_out_pending(netif);
+        while (!pending && ((int)(sys_time_us() - start) < budget))
+        {
+            pending = netif_out_pending(netif);
+        }
+        if (pending)
         {
             continue;
         }
-        plat_memset(rw_buffer, 0, sizeof(rw_buffer));
-        int total_size = buf->total_size;
-        pktbuf_read(buf, rw_buffer, total_size);
-        pktbuf_free(buf);
-        //send net data packet to dest
-        if (pcap_inject(pcap, rw_buffer, total_size) == -1)
+        netif->out_poll.budget /= 2;
+
+        //woken by netif_pcap_xmit, and now and then to see the stop request.
+        //wakeups for frames already sent are dropped, the drain above covers them
+        if (sys_sem_wait(dev->tx_sem, PCAP_STOP_TMO) == 0)
         {
-            debug_error(DEBUG_NETIF, "pcap send failed, size:%d err:%s\n", total_size, pcap_geterr(pcap));
+            sys_sem_take(dev->tx_sem, NETIF_OUTQ_SIZE * NETIF_QUEUE_MAX);
         }
     }
+    sys_sem_notify(dev->tx_done);
 }
 
 net_err_t netif_pcap_open(struct netif_t * netif, void * data)
 {
     pcap_data_t * pcap_data = (pcap_data_t *) data;
-    pcap_t * pcap = pcap_device_open(pcap_data->ip, pcap_data->hwaddr);
-    if (pcap == (pcap_t *)0)
+    const netif_rcv_cfg_t * cfg = &netif->rcv_cfg;
+    pcap_t * rx = pcap_device_open(pcap_data->ip, pcap_data->hwaddr, cfg->buf_size, cfg->immediate, NETIF_RCV_TMO);
+    if (rx == (pcap_t *)0)
     {
         debug_error(DEBUG_NETIF, "pcap open failed, name: %s\n", netif->name);
         return NET_ERR_IO;
     }
 
+    //a second handle for sending, so the capture handle can be swapped under the recv thread
+    pcap_t * tx = pcap_device_open(pcap_data->ip, pcap_data->hwaddr, PCAP_TX_BUF_SIZE, 1, 0);
+    if ((tx == (pcap_t *)0) || (pcap_device_set_filter(tx, "less 1") < 0))
+    {
+        debug_error(DEBUG_NETIF, "pcap open failed, name: %s\n", netif->name);
+        if (tx)
+        {
+            pcap_close(tx);
+        }
+        pcap_close(rx);
+        return NET_ERR_IO;
+    }
+
+    pcap_dev_t * dev = (pcap_dev_t *) plat_malloc(sizeof(pcap_dev_t));
+    if (dev == (pcap_dev_t *)0)
+    {
+        debug_error(DEBUG_NETIF, "no mem for pcap dev, name: %s\n", netif->name);
+        pcap_close(tx);
+        pcap_close(rx);
+        return NET_ERR_MEM;
+    }
+    dev->netif = netif;
+    dev->data = *pcap_data;
+    dev->rx = rx;
+    dev->tx = tx;
+    dev->stop = 0;
+    dev->rx_done = sys_sem_create(0);
+    dev->tx_done = sys_sem_create(0);
+    dev->tx_sem = sys_sem_create(0);
+    dev->locker = sys_mutex_create();
+    dev->filter[0] = '\0';
+    dev->filter_dirty = dev->cfg_dirty = 0;
+
     netif->type = NETIF_TYPE_ETHER;
     netif->mtu = ETHER_MTU;
-    netif->ops_data = pcap;
+    netif->ops_data = dev;
+    if ((pcap_data->queue_cnt > 1) && (netif_set_queue_cnt(netif, pcap_data->queue_cnt) < 0))
+    {
+        debug_warn(DEBUG_NETIF, "pcap queue count %d not set, name: %s\n", pcap_data->queue_cnt, netif->name);
+    }
     netif_set_hwaddr(netif, (const char *) pcap_data->hwaddr, 6);
 
-    sys_thread_create(recv_thread, netif);
-    sys_thread_create(xmit_thread, netif);
+    sys_thread_create(recv_thread, dev);
+    sys_thread_create(xmit_thread, dev);
     return NET_ERR_OK;
 }
 
+//wait a bounded time for a thread to leave, kicking both threads again on every retry
+static int wait_done(pcap_dev_t * dev, sys_sem_t done)
+{
+    for (int i = 0; i < PCAP_STOP_RETRY; i++)
+    {
+        if (sys_sem_wait(done, PCAP_STOP_TMO) == 0)
+        {
+            return 1;
+        }
+        sys_mutex_lock(dev->locker);
+        pcap_breakloop(dev->rx);
+        sys_mutex_unlock(dev->locker);
+        sys_sem_notify(dev->tx_sem);
+    }
+    return 0;
+}
+
 void netif_pcap_close(struct netif_t * netif)
 {
-    pcap_close(netif->ops_data);
+    pcap_dev_t * dev = (pcap_dev_t *) netif->ops_data;
+
+    //both threads use dev and the handle, wait for them before freeing
+    dev->stop = 1;
+    sys_mutex_lock(dev->locker);
+    pcap_breakloop(dev->rx);
+    sys_mutex_unlock(dev->locker);
+    sys_sem_notify(dev->tx_sem);
+    int rx_done = wait_done(dev, dev->rx_done);
+    int tx_done = wait_done(dev, dev->tx_done);
+    if (!rx_done || !tx_done)
+    {
+        //a thread is still inside the driver, leave dev to it instead of freeing it underneath
+        debug_warn(DEBUG_NETIF, "pcap %s threads did not stop, dev leaked", netif->name);
+        return;
+    }
+
+    pcap_close(dev->rx);
+    pcap_close(dev->tx);
+    sys_sem_free(dev->rx_done);
+    sys_sem_free(dev->tx_done);
+    sys_sem_free(dev->tx_sem);
+    sys_mutex_free(dev->locker);
+    plat_free(dev);
 }
 
 net_err_t netif_pcap_xmit(struct netif_t * netif)
 {
+    pcap_dev_t * dev = (pcap_dev_t *) netif->ops_data;
+    sys_sem_notify(dev->tx_sem);
+    return NET_ERR_OK;
+}
+
+//post the cfg to the recv thread and kick it out of pcap_dispatch
+net_err_t netif_pcap_set_rcv_cfg(struct netif_t * netif, const netif_rcv_cfg_t * cfg)
+{
+    pcap_dev_t * dev = (pcap_dev_t *) netif->ops_data;
+
+    sys_mutex_lock(dev->locker);
+    dev->cfg = *cfg;
+    dev->cfg_dirty = 1;
+    pcap_breakloop(dev->rx);
+    sys_mutex_unlock(dev->locker);
+    return NET_ERR_OK;
+}
+
+/**
+ * admit arp, icmp, ip fragments and the listed tcp/udp ports for our mac,
+ * so frames for closed ports are dropped before they are copied into pktbufs.
+ * the filter is posted to the recv thread, which owns the capture handle
+ */
+net_err_t netif_pcap_set_filter(struct netif_t * netif, const netif_filter_t * filter)
+{
+    pcap_dev_t * dev = (pcap_dev_t *) netif->ops_data;
+    sys_mutex_lock(dev->locker);
+
+    char * filter_exp = dev->filter;
+    const uint8_t * mac = netif->hwaddr.addr;
+    int len = plat_sprintf(filter_exp,
+        "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
+        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    //a forwarding netif carries traffic for any port
+    if (!filter->all && !netif->forward)
+    {
+        len += plat_sprintf(filter_exp + len, " and (not ip or icmp or (ip[6:2] & 0x1fff != 0)");
+        for (int i = 0; i < filter->tcp_cnt; i++)
+        {
+            len += plat_sprintf(filter_exp + len, " or tcp dst port %d", filter->tcp_ports[i]);
+        }
+        for (int i = 0; i < filter->udp_cnt; i++)
+        {
+            len += plat_sprintf(filter_exp + len, " or udp dst port %d", filter->udp_ports[i]);
+        }
+        plat_sprintf(filter_exp + len, ")");
+    }
+
+    dev->filter_dirty = 1;
+    pcap_breakloop(dev->rx);
+    sys_mutex_unlock(dev->locker);
     return NET_ERR_OK;
 }
 
@@ -100,4 +360,6 @@ const struct netif_ops_t netdev_ops = {
     .open = netif_pcap_open,
     .close = netif_pcap_close,
     .xmit = netif_pcap_xmit,
+    .set_filter = netif_pcap_set_filter,
+    .set_rcv_cfg = netif_pcap_set_rcv_cfg,
 };
@@ -12,6 +12,9 @@ typedef struct {
     const char * ip;
 
     const uint8_t * hwaddr;
+
+    //rx/tx queue pairs, 0: one
+    int queue_cnt;
 } pcap_data_t;
 
 extern const struct netif_ops_t netdev_ops;
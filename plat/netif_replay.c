@@ -0,0 +1,503 @@
+//
+// Created by xsy on 2024/6/22.
+//
+
+#include "netif_replay.h"
+#include "sys_plat.h"
+#include "ether.h"
+
+#define PCAP_MAGIC_US           0xA1B2C3D4
+#define PCAP_MAGIC_NS           0xA1B23C4D
+#define PCAPNG_BLK_SHB          0x0A0D0D0A
+#define PCAPNG_BLK_IDB          0x00000001
+#define PCAPNG_BLK_SPB          0x00000003
+#define PCAPNG_BLK_EPB          0x00000006
+#define PCAPNG_BYTE_ORDER       0x1A2B3C4D
+#define PCAPNG_OPT_TSRESOL      9
+#define PCAP_LINK_ETHER         1
+//longest the replay thread blocks without looking at stop, in ms
+#define REPLAY_STOP_TMO         100
+
+static uint32_t swap32(replay_data_t * data, uint32_t v)
+{
+    if (!data->swapped)
+    {
+        return v;
+    }
+    return ((v & 0xFF) << 24) | ((v & 0xFF00) << 8) | ((v >> 8) & 0xFF00) | (v >> 24);
+}
+
+static uint16_t swap16(replay_data_t * data, uint16_t v)
+{
+    return data->swapped ? (uint16_t)((v << 8) | (v >> 8)) : v;
+}
+
+static int read_u32(replay_data_t * data, uint32_t * v)
+{
+    if (fread(v, sizeof(uint32_t), 1, data->file) != 1)
+    {
+        return 0;
+    }
+    *v = swap32(data, *v);
+    return 1;
+}
+
+/**
+ * @return ts converted to us
+ */
+static uint64_t ts_to_us(replay_data_t * data, uint64_t ts)
+{
+    for (int i = data->tsresol; i > 6; i--)
+    {
+        ts /= 10;
+    }
+    for (int i = data->tsresol; i < 6; i++)
+    {
+        ts *= 10;
+    }
+    return ts;
+}
+
+/**
+ * copy the frame's data into data->frame, the part beyond REPLAY_FRAME_MAX is skipped
+ */
+static int read_frame_data(replay_data_t * data, uint32_t cap_len, uint32_t blk_remain)
+{
+    int size = cap_len > REPLAY_FRAME_MAX ? REPLAY_FRAME_MAX : (int)cap_len;
+    if (fread(data->frame, 1, size, data->file) != (size_t)size)
+    {
+        return -1;
+    }
+    if (blk_remain > (uint32_t)size)
+    {
+        fseek(data->file, (long)(blk_remain - size), SEEK_CUR);
+    }
+    return size;
+}
+
+/**
+ * parse interface description block, only the ts resolution is used
+ */
+static void read_idb(replay_data_t * data, uint32_t body_len)
+{
+    uint8_t body[256];
+    uint32_t size = body_len > sizeof(body) ? sizeof(body) : body_len;
+    if (fread(body, 1, size, data->file) != size)
+    {
+        return;
+    }
+    fseek(data->file, (long)(body_len - size), SEEK_CUR);
+
+    uint16_t link_type = swap16(data, *(uint16_t *)body);
+    if (link_type != PCAP_LINK_ETHER)
+    {
+        debug_warn(DEBUG_NETIF, "replay: link type %d is not ethernet", link_type);
+    }
+
+    data->tsresol = 6;
+    uint32_t pos = 8;
+    while (pos + 4 <= size)
+    {
+        uint16_t code = swap16(data, *(uint16_t *)(body + pos));
+        uint16_t len = swap16(data, *(uint16_t *)(body + pos + 2));
+        if (code == 0)
+        {
+            break;
+        }
+        if ((code == PCAPNG_OPT_TSRESOL) && (len == 1) && !(body[pos + 4] & 0x80))
+        {
+            data->tsresol = body[pos + 4];
+        }
+        pos += 4 + ((len + 3) & ~3);
+    }
+}
+
+/**
+ * read next frame into data->frame
+ * @return frame size, 0 at end of file, < 0 on error
+ */
+static int read_frame(replay_data_t * data, uint64_t * ts_us)
+{
+    if (data->classic)
+    {
+        uint32_t hdr[4];
+        if (fread(hdr, sizeof(hdr), 1, data->file) != 1)
+        {
+            return 0;
+        }
+        uint32_t cap_len = swap32(data, hdr[2]);
+        uint64_t ts = (uint64_t)swap32(data, hdr[0]) * 1000000;
+        uint64_t frac = swap32(data, hdr[1]);
+        *ts_us = ts + ((data->tsresol == 9) ? frac / 1000 : frac);
+        return read_frame_data(data, cap_len, cap_len);
+    }
+
+    for (;;)
+    {
+        uint32_t type, total_len;
+        if (!read_u32(data, &type) || !read_u32(data, &total_len))
+        {
+            return 0;
+        }
+        if (total_len < 12)
+        {
+            return -1;
+        }
+        uint32_t body_len = total_len - 12;
+        switch (type) {
+            case PCAPNG_BLK_EPB:
+            {
+                uint32_t hdr[5];
+                if (fread(hdr, sizeof(hdr), 1, data->file) != 1)
+                {
+                    return -1;
+                }
+                uint64_t ts = ((uint64_t)swap32(data, hdr[1]) << 32) | swap32(data, hdr[2]);
+                *ts_us = ts_to_us(data, ts);
+                int size = read_frame_data(data, swap32(data, hdr[3]), body_len - sizeof(hdr));
+                fseek(data->file, 4, SEEK_CUR);
+                return size;
+            }
+            case PCAPNG_BLK_SPB:
+            {
+                uint32_t orig_len;
+                if (!read_u32(data, &orig_len))
+                {
+                    return -1;
+                }
+                uint32_t cap_len = body_len - 4;
+                *ts_us = 0;
+                int size = read_frame_data(data, orig_len < cap_len ? orig_len : cap_len, cap_len);
+                fseek(data->file, 4, SEEK_CUR);
+                return size;
+            }
+            case PCAPNG_BLK_IDB:
+                read_idb(data, body_len);
+                fseek(data->file, 4, SEEK_CUR);
+                break;
+            case PCAPNG_BLK_SHB:
+            {
+                uint32_t magic;
+                if (fread(&magic, sizeof(magic), 1, data->file) != 1)
+                {
+                    return -1;
+                }
+                data->swapped = magic != PCAPNG_BYTE_ORDER;
+                //block length was read before the byte order was known
+                total_len = data->swapped ? swap32(data, total_len) : total_len;
+                fseek(data->file, (long)(total_len - 12), SEEK_CUR);
+                break;
+            }
+            default:
+                fseek(data->file, (long)(body_len + 4), SEEK_CUR);
+                break;
+        }
+    }
+}
+
+static net_err_t open_capture(replay_data_t * data)
+{
+    data->file = fopen(data->path, "rb");
+    if (!data->file)
+    {
+        debug_error(DEBUG_NETIF, "replay: open %s failed", data->path);
+        return NET_ERR_SYS;
+    }
+
+    uint32_t magic;
+    if (fread(&magic, sizeof(magic), 1, data->file) != 1)
+    {
+        debug_error(DEBUG_NETIF, "replay: empty file");
+        return NET_ERR_SYS;
+    }
+
+    data->swapped = 0;
+    data->tsresol = 6;
+    if ((magic == PCAP_MAGIC_US) || (magic == PCAP_MAGIC_NS)
+        || (swap32(&(replay_data_t){.swapped = 1}, magic) == PCAP_MAGIC_US)
+        || (swap32(&(replay_data_t){.swapped = 1}, magic) == PCAP_MAGIC_NS))
+    {
+        data->classic = 1;
+        data->swapped = (magic != PCAP_MAGIC_US) && (magic != PCAP_MAGIC_NS);
+        if (swap32(data, magic) == PCAP_MAGIC_NS)
+        {
+            data->tsresol = 9;
+        }
+
+        uint32_t hdr[5];
+        if (fread(hdr, sizeof(hdr), 1, data->file) != 1)
+        {
+            debug_error(DEBUG_NETIF, "replay: bad pcap header");
+            return NET_ERR_SYS;
+        }
+        if (swap32(data, hdr[4]) != PCAP_LINK_ETHER)
+        {
+            debug_warn(DEBUG_NETIF, "replay: link type is not ethernet");
+        }
+        return NET_ERR_OK;
+    }
+    else if (magic == PCAPNG_BLK_SHB)
+    {
+        data->classic = 0;
+        rewind(data->file);
+        return NET_ERR_OK;
+    }
+
+    debug_error(DEBUG_NETIF, "replay: unknown file format");
+    return NET_ERR_NOT_SUPPORT;
+}
+
+static void write_tx_header(replay_data_t * data)
+{
+    uint32_t hdr[6] = {PCAP_MAGIC_US, 0x00040002, 0, 0, REPLAY_FRAME_MAX, PCAP_LINK_ETHER};
+    fwrite(hdr, sizeof(hdr), 1, data->tx_file);
+}
+
+static pktbuf_t * frame_to_buf(replay_data_t * data, int size)
+{
+    pktbuf_t * buf = pktbuf_alloc(size);
+    if (!buf)
+    {
+        return (pktbuf_t *)0;
+    }
+    pktbuf_write(buf, data->frame, size);
+    return buf;
+}
+
+/**
+ * sleep in slices so a close never waits out a long gap of the capture
+ */
+static void replay_sleep(replay_data_t * data, int ms)
+{
+    while ((ms > 0) && !data->stop)
+    {
+        int slice = (ms > REPLAY_STOP_TMO) ? REPLAY_STOP_TMO : ms;
+        sys_sleep(slice);
+        ms -= slice;
+    }
+}
+
+/**
+ * hand a frame to in_q, dropping it if nobody drains in_q in time or the netif closes
+ */
+static void put_frame(netif_t * netif, replay_data_t * data, pktbuf_t * buf)
+{
+    if (data->stop || (netif_put_in(netif, buf, REPLAY_STOP_TMO) < 0))
+    {
+        data->drop_cnt++;
+        pktbuf_free(buf);
+    }
+}
+
+/**
+ * hand a batch to in_q, blocking a bounded time on whatever does not fit
+ */
+static void put_burst(netif_t * netif, pktbuf_t ** bufs, int cnt)
+{
+    int n = netif_put_in_burst(netif, 0, bufs, cnt);
+    for (int i = n; i < cnt; i++)
+    {
+        put_frame(netif, (replay_data_t *)netif->ops_data, bufs[i]);
+    }
+}
+
+static void replay_thread(void * arg)
+{
+    netif_t * netif = (netif_t *)arg;
+    replay_data_t * data = (replay_data_t *)netif->ops_data;
+
+    //frames are only useful once the netif has an address
+    while (!data->stop && (netif->state != NETIF_ACTIVE))
+    {
+        sys_sleep(10);
+    }
+
+    net_time_t time;
+    sys_time_curr(&time);
+    uint64_t first_ts = 0;
+    int first = 1;
+
+    pktbuf_t * bufs[NETIF_INQ_SIZE];
+    int cnt = 0;
+    while (!data->stop)
+    {
+        uint64_t ts;
+        int size = read_frame(data, &ts);
+        if (size <= 0)
+        {
+            if (size < 0)
+            {
+                debug_error(DEBUG_NETIF, "replay: bad capture file");
+            }
+            break;
+        }
+        if (size < (int)sizeof(ether_hdr_t))
+        {
+            continue;
+        }
+
+        if (data->timed)
+        {
+            if (first)
+            {
+                first_ts = ts;
+                first = 0;
+            }
+            data->run_ms += sys_time_goes(&time);
+            int wait_ms = (int)((ts - first_ts) / 1000) - data->run_ms;
+            if (wait_ms > 0)
+            {
+                replay_sleep(data, wait_ms);
+            }
+        }
+
+        pktbuf_t * buf = frame_to_buf(data, size);
+        while (!buf && !data->timed && !data->stop)
+        {
+            //max rate: wait for the stack to release buffers instead of dropping
+            put_burst(netif, bufs, cnt);
+            cnt = 0;
+            sys_sleep(1);
+            buf = frame_to_buf(data, size);
+        }
+        if (!buf)
+        {
+            debug_warn(DEBUG_NETIF, "replay: no pktbuf, frame dropped");
+            continue;
+        }
+        data->rx_cnt++;
+
+        if (data->timed)
+        {
+            put_frame(netif, data, buf);
+            continue;
+        }
+
+        //read each time, the burst may be changed while replaying
+        bufs[cnt++] = buf;
+        if (cnt >= netif->rcv_cfg.burst)
+        {
+            put_burst(netif, bufs, cnt);
+            cnt = 0;
+        }
+    }
+    put_burst(netif, bufs, cnt);
+
+    data->run_ms += sys_time_goes(&time);
+    fclose(data->file);
+    data->file = (FILE *)0;
+    data->done = 1;
+    debug_info(DEBUG_NETIF, "replay: %d frames in %d ms, %d dropped", data->rx_cnt, data->run_ms, data->drop_cnt);
+    sys_sem_notify(data->exit_sem);
+}
+
+static net_err_t replay_open(struct netif_t * netif, void * ops_data)
+{
+    replay_data_t * data = (replay_data_t *)ops_data;
+    data->rx_cnt = data->tx_cnt = data->drop_cnt = data->run_ms = 0;
+    data->done = data->stop = 0;
+    data->tx_file = (FILE *)0;
+
+    net_err_t err = open_capture(data);
+    if (err < 0)
+    {
+        if (data->file)
+        {
+            fclose(data->file);
+            data->file = (FILE *)0;
+        }
+        return err;
+    }
+
+    if (data->tx_path)
+    {
+        data->tx_file = fopen(data->tx_path, "wb");
+        if (!data->tx_file)
+        {
+            debug_error(DEBUG_NETIF, "replay: open %s failed", data->tx_path);
+            fclose(data->file);
+            return NET_ERR_SYS;
+        }
+        write_tx_header(data);
+    }
+
+    netif->type = NETIF_TYPE_ETHER;
+    netif->mtu = ETHER_MTU;
+    if (data->hwaddr)
+    {
+        netif_set_hwaddr(netif, (const char *)data->hwaddr, ETHER_HWA_SIZE);
+    }
+
+    data->exit_sem = sys_sem_create(0);
+    data->tx_locker = sys_mutex_create();
+    if ((data->exit_sem == SYS_SEM_INVALID) || (data->tx_locker == SYS_MUTEX_INVALID)
+        || (sys_thread_create(replay_thread, netif) == SYS_THREAD_INVALID))
+    {
+        debug_error(DEBUG_NETIF, "replay: create thread failed");
+        if (data->exit_sem != SYS_SEM_INVALID)
+        {
+            sys_sem_free(data->exit_sem);
+        }
+        if (data->tx_locker != SYS_MUTEX_INVALID)
+        {
+            sys_mutex_free(data->tx_locker);
+        }
+        fclose(data->file);
+        if (data->tx_file)
+        {
+            fclose(data->tx_file);
+        }
+        return NET_ERR_SYS;
+    }
+    return NET_ERR_OK;
+}
+
+static void replay_close(struct netif_t * netif)
+{
+    replay_data_t * data = (replay_data_t *)netif->ops_data;
+
+    //the replay thread sees stop within REPLAY_STOP_TMO and closes the capture itself,
+    //wait for it so it never touches the netif after it is freed
+    data->stop = 1;
+    sys_sem_wait(data->exit_sem, 0);
+    sys_sem_free(data->exit_sem);
+
+    sys_mutex_lock(data->tx_locker);
+    if (data->tx_file)
+    {
+        fclose(data->tx_file);
+        data->tx_file = (FILE *)0;
+    }
+    sys_mutex_unlock(data->tx_locker);
+    sys_mutex_free(data->tx_locker);
+}
+
+static net_err_t replay_xmit(struct netif_t * netif)
+{
+    replay_data_t * data = (replay_data_t *)netif->ops_data;
+
+    pktbuf_t * buf;
+    while ((buf = netif_get_out(netif, -1)))
+    {
+        data->tx_cnt++;
+        sys_mutex_lock(data->tx_locker);
+        if (data->tx_file)
+        {
+            int size = buf->total_size > REPLAY_FRAME_MAX ? REPLAY_FRAME_MAX : buf->total_size;
+            pktbuf_read(buf, data->tx_frame, size);
+            uint32_t rec[4] = {(uint32_t)(data->run_ms / 1000), (uint32_t)(data->run_ms % 1000) * 1000,
+                               (uint32_t)size, (uint32_t)buf->total_size};
+            fwrite(rec, sizeof(rec), 1, data->tx_file);
+            fwrite(data->tx_frame, 1, size, data->tx_file);
+        }
+        sys_mutex_unlock(data->tx_locker);
+        pktbuf_free(buf);
+    }
+    return NET_ERR_OK;
+}
+
+const struct netif_ops_t replay_ops = {
+        .open = replay_open,
+        .close = replay_close,
+        .xmit = replay_xmit,
+};
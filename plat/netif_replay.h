@@ -0,0 +1,53 @@
+//
+// Created by xsy on 2024/6/22.
+//
+
+#ifndef NET_NETIF_REPLAY_H
+#define NET_NETIF_REPLAY_H
+
+#include <stdio.h>
+#include "net_err.h"
+#include "netif.h"
+
+/**
+ * ops_data of a replay netif, frames of a .pcap/.pcapng capture are fed into in_q
+ */
+typedef struct replay_data_t {
+    //capture file to replay
+    const char * path;
+    //1: keep the captured inter-frame gaps, 0: replay as fast as in_q drains
+    int timed;
+    //capture file recording transmitted frames, null: discard them
+    const char * tx_path;
+    //hardware addr of the netif
+    const uint8_t * hwaddr;
+
+    //frames replayed, frames transmitted
+    int rx_cnt, tx_cnt;
+    //frames in_q did not take within REPLAY_STOP_TMO or dropped on close
+    int drop_cnt;
+    //time spent replaying, in ms
+    int run_ms;
+    //set when the whole file has been replayed
+    int done;
+
+    //driver state
+    FILE * file;
+    FILE * tx_file;
+    //pcapng: 0, classic pcap: 1
+    int classic;
+    int swapped;
+    //timestamp resolution, 10^-tsresol s
+    int tsresol;
+    int stop;
+    //notified by the replay thread when it ends
+    sys_sem_t exit_sem;
+    //serializes tx_file between xmit and close
+    sys_mutex_t tx_locker;
+    uint8_t frame[REPLAY_FRAME_MAX];
+    uint8_t tx_frame[REPLAY_FRAME_MAX];
+} replay_data_t;
+
+extern const struct netif_ops_t replay_ops;
+
+#endif //NET_NETIF_REPLAY_H
@@ -41,6 +41,11 @@ int sys_time_goes (net_time_t * pre) {
     return diff_ms;    
 }
 
+uint32_t sys_time_us (void) {
+    // only tick resolution here
+    return (uint32_t)sys_get_ticks() * OS_TICK_MS * 1000;
+}
+
 // create semaphore
 sys_sem_t sys_sem_create(int init_count) {
     sys_sem_t sem = (sys_sem_t)mblock_alloc(&sem_mblock, -1);
@@ -62,6 +67,20 @@ void sys_sem_notify(sys_sem_t sem) {
     sem_notify(sem);
 }
 
+int sys_sem_take(sys_sem_t sem, int cnt) {
+    //the kernel sem has no batch ops, callers only take counts known to be there
+    for (int i = 0; i < cnt; i++) {
+        sem_wait_tmo(sem, 0);
+    }
+    return cnt;
+}
+
+void sys_sem_notify_cnt(sys_sem_t sem, int cnt) {
+    while (cnt-- > 0) {
+        sem_notify(sem);
+    }
+}
+
 // create mutex
 sys_mutex_t sys_mutex_create(void) {
     sys_mutex_t m = (sys_mutex_t)mblock_alloc(&mutex_mblock, -1);
@@ -182,6 +201,16 @@ int sys_time_goes (net_time_t * pre)
     return diff_ms;
 }
 
+uint32_t sys_time_us (void)
+{
+    LARGE_INTEGER freq, curr;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&curr);
+    // split so the multiply can not overflow on long uptimes
+    return (uint32_t)((curr.QuadPart / freq.QuadPart) * 1000000
+                      + (curr.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart);
+}
+
 sys_sem_t sys_sem_create(int init_count) {
     return CreateSemaphore(NULL, init_count, 0xFFFF, NULL);
 }
@@ -209,6 +238,20 @@ void sys_sem_notify(sys_sem_t sem) {
     ReleaseSemaphore(sem, 1, NULL);
 }
 
+int sys_sem_take(sys_sem_t sem, int cnt) {
+    int n = 0;
+    while ((n < cnt) && (WaitForSingleObject(sem, 0) == WAIT_OBJECT_0)) {
+        n++;
+    }
+    return n;
+}
+
+void sys_sem_notify_cnt(sys_sem_t sem, int cnt) {
+    if (cnt > 0) {
+        ReleaseSemaphore(sem, cnt, NULL);
+    }
+}
+
 /**
  * create thread mutex
  */
@@ -308,6 +351,12 @@ int sys_time_goes (net_time_t * pre) {
     return diff_ms;
 }
 
+uint32_t sys_time_us (void) {
+    struct timeval curr;
+    gettimeofday(&curr, NULL);
+    return (uint32_t)curr.tv_sec * 1000000 + (uint32_t)curr.tv_usec;
+}
+
 sys_sem_t sys_sem_create(int init_count) {
     sys_sem_t sem = (sys_sem_t)malloc(sizeof(struct _xsys_sem_t));
     if (!sem) {
@@ -374,6 +423,32 @@ void sys_sem_notify(sys_sem_t sem) {
     pthread_mutex_unlock(&(sem->locker));
 }
 
+int sys_sem_take(sys_sem_t sem, int cnt) {
+    pthread_mutex_lock(&(sem->locker));
+
+    if (cnt > sem->count) {
+        cnt = sem->count > 0 ? sem->count : 0;
+    }
+    sem->count -= cnt;
+
+    pthread_mutex_unlock(&(sem->locker));
+    return cnt;
+}
+
+void sys_sem_notify_cnt(sys_sem_t sem, int cnt) {
+    if (cnt <= 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&(sem->locker));
+
+    sem->count += cnt;
+
+    pthread_cond_broadcast(&(sem->cond));
+
+    pthread_mutex_unlock(&(sem->locker));
+}
+
 sys_thread_t sys_thread_create(void (*entry)(void * arg), void* arg) {
     pthread_t pthread;
 
@@ -536,8 +611,10 @@ int pcap_show_list(void) {
 
 /**
  * open pcap dev interface
+ * buf_size: kernel capture buffer size, immediate: 1 deliver frames at once,
+ * 0 let the kernel batch them for up to tmo_ms
  */
-pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr) {
+pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr, int buf_size, int immediate, int tmo_ms) {
     // load pcap lib
     if (load_pcap_lib() < 0) {
         fprintf(stderr, "load pcap lib errorplease isntall npcap.dll\n");
@@ -580,12 +657,18 @@ pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr) {
         return (pcap_t*)0;
     }
 
-    if (pcap_set_timeout(pcap, 0) != 0) {
+    if (pcap_set_buffer_size(pcap, buf_size) != 0) {
+        fprintf(stderr, "pcap_open: set buffer size failed: %s\n", pcap_geterr(pcap));
+        return (pcap_t*)0;
+    }
+
+    //0 would block reads forever, immediate mode delivers without waiting for it anyway
+    if (pcap_set_timeout(pcap, tmo_ms) != 0) {
         fprintf(stderr, "pcap_open: set none block failed: %s\n", pcap_geterr(pcap));
         return (pcap_t*)0;
     }
 
-    if (pcap_set_immediate_mode(pcap, 1) != 0) {
+    if (pcap_set_immediate_mode(pcap, immediate) != 0) {
         fprintf(stderr, "pcap_open: set im block failed: %s\n", pcap_geterr(pcap));
         return (pcap_t*)0;
     }
@@ -601,20 +684,32 @@ pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr) {
     }
 
     char filter_exp[256];
-    struct bpf_program fp;
     sprintf(filter_exp,
         "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
         mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5],
         mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
-    if (pcap_compile(pcap, &fp, filter_exp, 0, net) == -1) {
-        printf("pcap_open: couldn't parse filter %s: %s\n", filter_exp, pcap_geterr(pcap));
+    if (pcap_device_set_filter(pcap, filter_exp) < 0) {
         return (pcap_t*)0;
     }
+    return pcap;
+}
+
+/**
+ * compile filter_exp and install it on pcap, replacing the current filter
+ */
+int pcap_device_set_filter(pcap_t * pcap, const char * filter_exp) {
+    struct bpf_program fp;
+    if (pcap_compile(pcap, &fp, filter_exp, 1, PCAP_NETMASK_UNKNOWN) == -1) {
+        printf("pcap_open: couldn't parse filter %s: %s\n", filter_exp, pcap_geterr(pcap));
+        return -1;
+    }
     if (pcap_setfilter(pcap, &fp) == -1) {
         printf("pcap_open: couldn't install filter %s: %s\n", filter_exp, pcap_geterr(pcap));
-        return (pcap_t*)0;
+        pcap_freecode(&fp);
+        return -1;
     }
-    return pcap;
+    pcap_freecode(&fp);
+    return 0;
 }
 
 #endif
@@ -63,6 +63,9 @@ typedef sem_t * sys_sem_t;            // semaphore
 #define plat_sprintf        kernel_sprintf
 #define plat_vsprintf       kernel_vsprintf
 #define plat_printf         log_printf
+//no heap for the stack here, pools keep to their static blocks
+#define plat_malloc(size)   ((void *)0)
+#define plat_free(ptr)
 
 #elif defined(SYS_PLAT_WINDOWS)
 #define WIN32_LEAN_AND_MEAN
@@ -92,11 +95,14 @@ typedef HANDLE sys_sem_t;           // semaphore
 #define plat_sprintf        sprintf
 #define plat_vsprintf       vsprintf
 #define plat_printf         printf
+#define plat_malloc         malloc
+#define plat_free           free
 
 // PCAP netif function
 int pcap_find_device(const char* ip, char* name_buf);
 int pcap_show_list(void);
-pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr);
+pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr, int buf_size, int immediate, int tmo_ms);
+int pcap_device_set_filter(pcap_t * pcap, const char * filter_exp);
 
 #elif defined(SYS_PLAT_LINUX) || defined(SYS_PLAT_MAC)
 
@@ -126,6 +132,8 @@ typedef struct timeval net_time_t;      // time type
 #define plat_sprintf        sprintf
 #define plat_vsprintf       vsprintf
 #define plat_printf         printf
+#define plat_malloc         malloc
+#define plat_free           free
 
 typedef struct _xsys_sem_t {
     int count;                          // semaphore count
@@ -139,7 +147,8 @@ typedef pthread_mutex_t * sys_mutex_t;      // semaphore
 // PCAP netif funtion
 int pcap_find_device(const char* ip, char* name_buf);
 int pcap_show_list(void);
-pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr);
+pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr, int buf_size, int immediate, int tmo_ms);
+int pcap_device_set_filter(pcap_t * pcap, const char * filter_exp);
 
 #else
     #error "Unkonw platform"
@@ -149,6 +158,10 @@ sys_sem_t sys_sem_create(int init_count);
 void sys_sem_free(sys_sem_t sem);
 int sys_sem_wait(sys_sem_t sem, uint32_t ms);
 void sys_sem_notify(sys_sem_t sem);
+//take up to cnt counts without blocking, return the counts taken
+int sys_sem_take(sys_sem_t sem, int cnt);
+//release cnt counts in one go
+void sys_sem_notify_cnt(sys_sem_t sem, int cnt);
 
 sys_mutex_t sys_mutex_create(void);
 void sys_mutex_free(sys_mutex_t mutex);
@@ -168,5 +181,8 @@ void sys_time_curr (net_time_t * time);
 
 int sys_time_goes (net_time_t * pre);
 
+// free running clock in us for short spins, it wraps so only differences mean anything
+uint32_t sys_time_us (void);
+
 
 #endif // SYS_PLAT_H